@@ -2,56 +2,287 @@
 #include <string>
 #include <vector>
 #include <queue>
+#include <algorithm>
+#include <new>
+#include <climits>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
 #include "BPlusTree.h"
+#include "NodeSearch.h"
+#include "TaskPool.h"
 
 using namespace std;
 
 // Node initialization
-Node::Node(bool isLeaf) : 
-    parent(nullptr), 
-    next(nullptr), 
-    isLeaf(isLeaf) 
-{}
+Node::Node(bool isLeaf, int capacity) :
+    numKeys(0),
+    capacity(capacity),
+    isLeaf(isLeaf),
+    pendingIndex(-1),
+    refCount(1),
+    next(nullptr)
+{
+    // Leaf values live inline in the node's block
+    if (isLeaf) {
+        for (int i = 0; i < capacity; i++) {
+            new (&values()[i]) string();
+        }
+    }
+}
 
 // Node deletion
 Node::~Node() {
-    for (auto& ptr : pointers) {
-        if (ptr) {
-            if (isLeaf) {
-                delete static_cast<string*>(ptr);
-            } else {
-                delete static_cast<Node*>(ptr);
-            }
+    if (isLeaf) {
+        for (int i = 0; i < capacity; i++) {
+            values()[i].~string();
         }
     }
 }
 
+size_t Node::slotOffset(int capacity) {
+    // Keys start right after the header; slots start at the next 8-byte boundary
+    return sizeof(Node) + (capacity * sizeof(int) + 7) / 8 * 8;
+}
+
+size_t Node::blockSize(bool isLeaf, int capacity) {
+    if (isLeaf) {
+        return slotOffset(capacity) + capacity * sizeof(string);
+    }
+    return slotOffset(capacity) + (capacity + 1) * (sizeof(Node*) + sizeof(uint64_t) + sizeof(long long));
+}
+
+
+// Arena initialization
+NodeArena::NodeArena(size_t blockSize) :
+    blockSize(0),
+    blocksPerChunk(0),
+    freeList(nullptr),
+    chunkNext(nullptr),
+    chunkEnd(nullptr)
+{
+    reset(blockSize);
+}
+
+// Arena deletion
+NodeArena::~NodeArena() {
+    for (void* chunk : chunks) {
+        ::operator delete(chunk, align_val_t(kAlignment));
+    }
+}
+
+NodeArena::NodeArena(NodeArena&& other) noexcept :
+    blockSize(other.blockSize),
+    blocksPerChunk(other.blocksPerChunk),
+    chunks(move(other.chunks)),
+    freeList(other.freeList),
+    chunkNext(other.chunkNext),
+    chunkEnd(other.chunkEnd)
+{
+    other.chunks.clear();
+    other.freeList = nullptr;
+    other.chunkNext = other.chunkEnd = nullptr;
+}
+
+NodeArena& NodeArena::operator=(NodeArena&& other) noexcept {
+    if (this == &other) return *this;
+    reset(other.blockSize);
+    chunks.swap(other.chunks);
+    freeList = other.freeList;
+    chunkNext = other.chunkNext;
+    chunkEnd = other.chunkEnd;
+    other.freeList = nullptr;
+    other.chunkNext = other.chunkEnd = nullptr;
+    return *this;
+}
+
+// Frees every chunk and starts handing out blocks of a new size
+void NodeArena::reset(size_t newBlockSize) {
+    for (void* chunk : chunks) {
+        ::operator delete(chunk, align_val_t(kAlignment));
+    }
+    chunks.clear();
+    freeList = nullptr;
+    chunkNext = chunkEnd = nullptr;
+
+    // Round up so every block starts on a cache line
+    blockSize = (newBlockSize + kAlignment - 1) / kAlignment * kAlignment;
+    blocksPerChunk = max<size_t>(8, 65536 / blockSize);
+}
+
+void* NodeArena::allocate() {
+    // Reuse a released block first
+    if (freeList) {
+        void* block = freeList;
+        freeList = *static_cast<void**>(block);
+        return block;
+    }
+
+    // Start a new chunk once the current one is used up
+    if (chunkNext == chunkEnd) {
+        size_t chunkSize = blockSize * blocksPerChunk;
+        chunkNext = static_cast<char*>(::operator new(chunkSize, align_val_t(kAlignment)));
+        chunkEnd = chunkNext + chunkSize;
+        chunks.push_back(chunkNext);
+    }
+
+    void* block = chunkNext;
+    chunkNext += blockSize;
+    return block;
+}
+
+void NodeArena::release(void* block) {
+    *static_cast<void**>(block) = freeList;
+    freeList = block;
+}
+
+void NodeArena::absorb(NodeArena& other) {
+    chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+    other.chunks.clear();
+    while (other.freeList) {
+        void* block = other.freeList;
+        other.freeList = *static_cast<void**>(block);
+        release(block);
+    }
+    for (; other.chunkNext != other.chunkEnd; other.chunkNext += blockSize) {
+        release(other.chunkNext);
+    }
+    other.chunkNext = other.chunkEnd = nullptr;
+}
+
+
+// Node store initialization
+NodeStore::NodeStore(int maxKeys) :
+    leafArena(Node::blockSize(true, maxKeys + 1)),
+    interiorArena(Node::blockSize(false, maxKeys + 1)),
+    hasRetired(false)
+{}
+
 
 // B+ tree initialization
-BPlusTree::BPlusTree(int maxKeys) : root(nullptr), maxKeys(maxKeys) {}
+BPlusTree::BPlusTree(int maxKeys) :
+    root(nullptr),
+    maxKeys(maxKeys),
+    store(make_shared<NodeStore>(maxKeys)),
+    lazyDeletion(false),
+    underflowThreshold(1),
+    multimap(false),
+    latencies(kTreeLatencyEnabled ? new TreeLatency() : nullptr)
+{}
+
+// B+ tree bulk-load initialization
+BPlusTree::BPlusTree(int maxKeys, const vector<pair<int, string>>& sortedPairs, double fillFactor) :
+    root(nullptr),
+    maxKeys(maxKeys),
+    store(make_shared<NodeStore>(maxKeys)),
+    lazyDeletion(false),
+    underflowThreshold(1),
+    multimap(false),
+    latencies(kTreeLatencyEnabled ? new TreeLatency() : nullptr)
+{
+    bulkLoad(sortedPairs, fillFactor);
+}
 
 // B+ tree destructor
 BPlusTree::~BPlusTree() {
+    clearCompactionQueue();
     destroyTree(root);
 }
-void BPlusTree::destroyTree(Node* node) {
+
+// Drops one reference to node, freeing it and then its children once nothing
+// else points at it. Nodes a snapshot still uses are left to the snapshot.
+void BPlusTree::releaseNode(Node* node) {
     if (!node) return;
+    if (node->refCount.fetch_sub(1, memory_order_acq_rel) != 1) return;
 
-    // If it's not a leaf, first destroy all children
     if (!node->isLeaf) {
-        for (auto& ptr : node->pointers) {
-            destroyTree(static_cast<Node*>(ptr));
+        for (int i = 0; i <= node->numKeys; i++) {
+            releaseNode(node->children()[i]);
         }
     }
-    // Now it's safe to delete the node itself
-    delete node;
+    freeNode(node);
+}
+
+Node* BPlusTree::newNode(bool isLeaf) {
+    // A moved-from tree gets a fresh store on its next allocation
+    if (!store) {
+        store = make_shared<NodeStore>(maxKeys);
+    } else if (store->hasRetired.load(memory_order_acquire)) {
+        drainRetired();
+    }
+    void* block = isLeaf ? store->leafArena.allocate() : store->interiorArena.allocate();
+    (isLeaf ? statCounters.leafNodes : statCounters.interiorNodes).add();
+    return new (block) Node(isLeaf, maxKeys + 1);
+}
+
+void BPlusTree::freeNode(Node* node) {
+    if (node->pendingIndex >= 0) {
+        unmarkForCompaction(node);
+    }
+    bool isLeaf = node->isLeaf;
+    (isLeaf ? statCounters.leafNodes : statCounters.interiorNodes).add(-1);
+    node->~Node();
+    if (isLeaf) {
+        store->leafArena.release(node);
+    } else {
+        store->interiorArena.release(node);
+    }
+}
+
+// Returns the blocks of nodes released snapshots freed to the arenas
+void BPlusTree::drainRetired() {
+    vector<pair<void*, bool>> blocks;
+    {
+        lock_guard<mutex> lock(store->retiredMutex);
+        blocks.swap(store->retired);
+        store->hasRetired.store(false, memory_order_relaxed);
+    }
+    for (const pair<void*, bool>& block : blocks) {
+        (block.second ? statCounters.leafNodes : statCounters.interiorNodes).add(-1);
+        if (block.second) {
+            store->leafArena.release(block.first);
+        } else {
+            store->interiorArena.release(block.first);
+        }
+    }
+}
+
+// Moves the tree, which must be empty, to a new store for nodes of maxKeys.
+// The old one lives on for as long as snapshots use it.
+void BPlusTree::resetStore() {
+    store = make_shared<NodeStore>(maxKeys);
+    statCounters.leafNodes.reset();
+    statCounters.interiorNodes.reset();
 }
 
 // B+ tree copy constructor
-BPlusTree::BPlusTree(const BPlusTree& other) : root(nullptr), maxKeys(other.maxKeys) {
+BPlusTree::BPlusTree(const BPlusTree& other) :
+    root(nullptr),
+    maxKeys(other.maxKeys),
+    store(make_shared<NodeStore>(other.maxKeys)),
+    lazyDeletion(other.lazyDeletion),
+    underflowThreshold(other.underflowThreshold),
+    multimap(other.multimap),
+    aggregator(other.aggregator),
+    latencies(kTreeLatencyEnabled ? new TreeLatency() : nullptr)
+{
     if (!other.root) return;
-    this->root = new Node(other.root->isLeaf);
-    copyNodes(this->root, other.root);
+    Node* previousLeaf = nullptr;
+    this->root = copyNodes(other.root, previousLeaf);
+}
+
+// B+ tree parallel copy constructor
+BPlusTree::BPlusTree(const BPlusTree& other, int threads) :
+    root(nullptr),
+    maxKeys(other.maxKeys),
+    store(make_shared<NodeStore>(other.maxKeys)),
+    lazyDeletion(other.lazyDeletion),
+    underflowThreshold(other.underflowThreshold),
+    multimap(other.multimap),
+    aggregator(other.aggregator),
+    latencies(kTreeLatencyEnabled ? new TreeLatency() : nullptr)
+{
+    copyParallel(other.root, threads);
 }
 
 // B+ tree assignment operator
@@ -59,108 +290,421 @@ BPlusTree& BPlusTree::operator=(const BPlusTree& other) {
     if (this == &other) return *this;  // Self-assignment check
 
     // Clean up current tree
+    clearCompactionQueue();
     destroyTree(this->root);
+    this->root = nullptr;
 
-    // Copy the other tree
+    // Copy the other tree into a store sized for its nodes
     this->maxKeys = other.maxKeys;
+    lazyDeletion = other.lazyDeletion;
+    underflowThreshold = other.underflowThreshold;
+    multimap = other.multimap;
+    aggregator = other.aggregator;
+    resetStore();
     if (other.root) {
-        this->root = new Node(other.root->isLeaf);
-        copyNodes(this->root, other.root);
-    } else {
-        this->root = nullptr;
+        Node* previousLeaf = nullptr;
+        this->root = copyNodes(other.root, previousLeaf);
     }
 
     return *this;
 }
 
-// Recursive function to deep-copy nodes
-void BPlusTree::copyNodes(Node* toNode, const Node* fromNode) {
-    toNode->keys = fromNode->keys;
+// B+ tree move constructor
+BPlusTree::BPlusTree(BPlusTree&& other) noexcept :
+    root(other.root),
+    maxKeys(other.maxKeys),
+    store(move(other.store)),
+    lazyDeletion(other.lazyDeletion),
+    underflowThreshold(other.underflowThreshold),
+    multimap(other.multimap),
+    pendingLeaves(move(other.pendingLeaves)),
+    aggregator(move(other.aggregator)),
+    latencies(kTreeLatencyEnabled ? new TreeLatency() : nullptr)
+{
+    // The node counts go with the nodes; the operation counts stay behind
+    statCounters.leafNodes = other.statCounters.leafNodes;
+    statCounters.interiorNodes = other.statCounters.interiorNodes;
+    other.statCounters.leafNodes.reset();
+    other.statCounters.interiorNodes.reset();
+    other.root = nullptr;
+    other.pendingLeaves.clear();
+}
+
+// B+ tree move assignment operator
+BPlusTree& BPlusTree::operator=(BPlusTree&& other) noexcept {
+    if (this == &other) return *this;
+
+    clearCompactionQueue();
+    destroyTree(root);
+    root = other.root;
+    maxKeys = other.maxKeys;
+    store = move(other.store);
+    lazyDeletion = other.lazyDeletion;
+    underflowThreshold = other.underflowThreshold;
+    multimap = other.multimap;
+    pendingLeaves = move(other.pendingLeaves);
+    aggregator = move(other.aggregator);
+    statCounters.leafNodes = other.statCounters.leafNodes;
+    statCounters.interiorNodes = other.statCounters.interiorNodes;
+    other.statCounters.leafNodes.reset();
+    other.statCounters.interiorNodes.reset();
+    other.root = nullptr;
+    other.pendingLeaves.clear();
+
+    return *this;
+}
+
+// Recursive function to deep-copy nodes, relinking the leaves in order
+Node* BPlusTree::copyNodes(const Node* fromNode, Node*& previousLeaf) {
+    Node* toNode = newNode(fromNode->isLeaf);
+    toNode->numKeys = fromNode->numKeys;
+    copy(fromNode->keys(), fromNode->keys() + fromNode->numKeys, toNode->keys());
 
     if (fromNode->isLeaf) {
-        for (const auto& ptr : fromNode->pointers) {
-            toNode->pointers.push_back(new string(*static_cast<string*>(ptr)));
+        copy(fromNode->values(), fromNode->values() + fromNode->numKeys, toNode->values());
+        if (previousLeaf) {previousLeaf->next = toNode;}
+        previousLeaf = toNode;
+        if (fromNode->pendingIndex >= 0) {markForCompaction(toNode);}
+    } else {
+        for (int i = 0; i <= fromNode->numKeys; i++) {
+            toNode->children()[i] = copyNodes(fromNode->children()[i], previousLeaf);
         }
+        copy(fromNode->counts(), fromNode->counts() + fromNode->numKeys + 1, toNode->counts());
+        copy(fromNode->aggregates(), fromNode->aggregates() + fromNode->numKeys + 1, toNode->aggregates());
+    }
+
+    return toNode;
+}
+
+// Subtrees per thread a parallel copy or destroy aims for, so that stealing
+// can even out subtrees of different sizes
+const size_t kSubtreesPerThread = 8;
+
+namespace {
+
+// A subtree for a parallel copy, and where its copy goes
+struct CopyTask {
+    const Node* fromNode;
+    Node* parent;  // nullptr for the root
+    int childIndex;
+    Node* firstLeaf;
+    Node* lastLeaf;
+    vector<Node*> pendingLeaves;  // Copies of the leaves queued for compaction
+};
+
+// Each worker of a parallel copy allocates from its own arenas
+struct CopyWorker {
+    NodeArena leafArena;
+    NodeArena interiorArena;
+    uint64_t leafNodes;
+    uint64_t interiorNodes;
+
+    CopyWorker(int maxKeys) :
+        leafArena(Node::blockSize(true, maxKeys + 1)),
+        interiorArena(Node::blockSize(false, maxKeys + 1)),
+        leafNodes(0),
+        interiorNodes(0)
+    {}
+};
+
+Node* copySubtree(const Node* fromNode, int maxKeys, CopyWorker& worker, CopyTask& task) {
+    bool isLeaf = fromNode->isLeaf;
+    Node* toNode = new (isLeaf ? worker.leafArena.allocate() : worker.interiorArena.allocate()) Node(isLeaf, maxKeys + 1);
+    toNode->numKeys = fromNode->numKeys;
+    copy(fromNode->keys(), fromNode->keys() + fromNode->numKeys, toNode->keys());
+
+    if (isLeaf) {
+        worker.leafNodes++;
+        copy(fromNode->values(), fromNode->values() + fromNode->numKeys, toNode->values());
+        if (task.lastLeaf) {
+            task.lastLeaf->next = toNode;
+        } else {
+            task.firstLeaf = toNode;
+        }
+        task.lastLeaf = toNode;
+        if (fromNode->pendingIndex >= 0) {task.pendingLeaves.push_back(toNode);}
     } else {
-        for (const auto& ptr : fromNode->pointers) {
-            Node* childNode = new Node(static_cast<Node*>(ptr));
-            toNode->pointers.push_back(childNode);
-            childNode->parent = toNode;
-            copyNodes(childNode, static_cast<Node*>(ptr));
+        worker.interiorNodes++;
+        for (int i = 0; i <= fromNode->numKeys; i++) {
+            toNode->children()[i] = copySubtree(fromNode->children()[i], maxKeys, worker, task);
         }
+        copy(fromNode->counts(), fromNode->counts() + fromNode->numKeys + 1, toNode->counts());
+        copy(fromNode->aggregates(), fromNode->aggregates() + fromNode->numKeys + 1, toNode->aggregates());
     }
+
+    return toNode;
 }
 
-bool BPlusTree::insert(int key, const string& value) {
-    // Create root with value and return true if tree is empty
-    if (!root) {
-        root = new Node(true);
-        root->keys.push_back(key);
-        root->pointers.push_back(new string(value));
-        return true;
+}
+
+// Copies the tree under fromRoot into this empty tree. The levels above the
+// first one with enough subtrees to go round are copied here; the subtrees
+// are then copied by a TaskPool, each worker into arenas of its own that the
+// store takes over afterwards. Leaves are linked across subtrees last.
+void BPlusTree::copyParallel(const Node* fromRoot, int threads) {
+    if (!fromRoot) return;
+    if (threads <= 1 || fromRoot->isLeaf) {
+        Node* previousLeaf = nullptr;
+        root = copyNodes(fromRoot, previousLeaf);
+        return;
     }
 
-    // Find the leaf with the designated key
-    Node* leaf = findLeaf(key);
+    vector<CopyTask> level = {{fromRoot, nullptr, 0, nullptr, nullptr, {}}};
+    while (level.size() < threads * kSubtreesPerThread && !level.front().fromNode->isLeaf) {
+        vector<CopyTask> below;
+        for (const CopyTask& task : level) {
+            const Node* fromNode = task.fromNode;
+            Node* toNode = newNode(false);
+            toNode->numKeys = fromNode->numKeys;
+            copy(fromNode->keys(), fromNode->keys() + fromNode->numKeys, toNode->keys());
+            copy(fromNode->counts(), fromNode->counts() + fromNode->numKeys + 1, toNode->counts());
+            copy(fromNode->aggregates(), fromNode->aggregates() + fromNode->numKeys + 1, toNode->aggregates());
+            if (task.parent) {
+                task.parent->children()[task.childIndex] = toNode;
+            } else {
+                root = toNode;
+            }
+            for (int i = 0; i <= fromNode->numKeys; i++) {
+                below.push_back({fromNode->children()[i], toNode, i, nullptr, nullptr, {}});
+            }
+        }
+        level.swap(below);
+    }
 
-    // Return false if the key already exists in the leaf
-    for (int i = 0; i < leaf->keys.size(); i++) {
-        if (key == leaf->keys[i]) {
-            // *static_cast<string*>(leaf->pointers[i]) = value; // Reassign value
-            return false;
+    TaskPool pool(threads);
+    vector<CopyWorker> workers;
+    workers.reserve(pool.size());
+    for (int i = 0; i < pool.size(); i++) {
+        workers.emplace_back(maxKeys);
+    }
+    vector<TaskPool::Task> tasks;
+    tasks.reserve(level.size());
+    for (CopyTask& task : level) {
+        tasks.push_back([this, &task, &workers](int worker) {
+            Node* toNode = copySubtree(task.fromNode, maxKeys, workers[worker], task);
+            task.parent->children()[task.childIndex] = toNode;
+        });
+    }
+    pool.run(tasks);
+
+    for (size_t i = 0; i < level.size(); i++) {
+        if (i + 1 < level.size()) {level[i].lastLeaf->next = level[i + 1].firstLeaf;}
+        for (Node* leaf : level[i].pendingLeaves) {
+            markForCompaction(leaf);
         }
     }
+    for (CopyWorker& worker : workers) {
+        store->leafArena.absorb(worker.leafArena);
+        store->interiorArena.absorb(worker.interiorArena);
+        statCounters.leafNodes.add(worker.leafNodes);
+        statCounters.interiorNodes.add(worker.interiorNodes);
+    }
+}
 
-    // Insert into the leaf node
-    insertIntoLeaf(leaf, key, value);
-        
-    // Split the leaf if necessary
-    if (leaf->keys.size() > maxKeys) {
-        splitLeaf(leaf);
+void BPlusTree::destroySubtree(Node* node) {
+    if (node->refCount.fetch_sub(1, memory_order_acq_rel) != 1) return;
+    if (!node->isLeaf) {
+        for (int i = 0; i <= node->numKeys; i++) {
+            destroySubtree(node->children()[i]);
+        }
     }
-    
-    return true;
+    node->~Node();
 }
 
-Node* BPlusTree::findLeaf(int key) {
-    Node* node = root;
+// Skipping the arenas makes this safe on any thread, and the blocks need not
+// be returned: the tree calls it only when it is about to leave the store.
+// With more than one thread, the top levels are released here and the
+// subtrees below them by a TaskPool.
+void BPlusTree::destroyTree(Node* root, int threads) {
+    if (!root) return;
+    if (threads <= 1) {
+        destroySubtree(root);
+        return;
+    }
 
-       
-    // While not a leaf, set node to the corresponding pointer
-    while(!node->isLeaf){
-        bool continueWhile = false;
-        
-        if(key < node->keys[0]){
-            node = static_cast<Node*>(node->pointers[0]);
-            continue;
-        }
-        
-        for (int i = 1; i < node->keys.size(); i++) {
-            if (node->keys[i-1] <= key && key < node->keys[i]) {
-                node = static_cast<Node*>(node->pointers[i]);
-                continueWhile = true;
-                break;
-            }            
+    vector<Node*> level = {root};
+    while (!level.empty() && level.size() < threads * kSubtreesPerThread && !level.front()->isLeaf) {
+        vector<Node*> below;
+        for (Node* node : level) {
+            // A snapshot may still use the node; once let go, it must not be touched
+            if (node->refCount.fetch_sub(1, memory_order_acq_rel) != 1) continue;
+            below.insert(below.end(), node->children(), node->children() + node->numKeys + 1);
+            node->~Node();
         }
-        if(continueWhile){continue;}
+        level.swap(below);
+    }
 
-        if(node->keys[node->keys.size()-1] <= key){
-            node = static_cast<Node*>(node->pointers[node->keys.size()]);
-            continue;
-        }
-        
-    }  
+    vector<TaskPool::Task> tasks;
+    tasks.reserve(level.size());
+    for (Node* node : level) {
+        tasks.push_back([node](int) {destroySubtree(node);});
+    }
+    TaskPool(threads).run(tasks);
+}
+
+void BPlusTree::clear(int threads) {
+    clearCompactionQueue();
+    Node* oldRoot = root;
+    shared_ptr<NodeStore> oldStore = store;  // The old nodes live in its arenas
+    root = nullptr;
+    resetStore();
+    destroyTree(oldRoot, threads);
+}
+
+future<void> BPlusTree::clearInBackground(int threads) {
+    clearCompactionQueue();
+    promise<void> done;
+    future<void> result = done.get_future();
+    if (!root) {
+        done.set_value();
+        return result;
+    }
+
+    Node* oldRoot = root;
+    shared_ptr<NodeStore> oldStore = store;
+    root = nullptr;
+    resetStore();
+    thread([oldRoot, threads](shared_ptr<NodeStore> oldStore, promise<void> done) {
+        destroyTree(oldRoot, threads);
+        oldStore.reset();
+        done.set_value();
+    }, move(oldStore), move(done)).detach();
+    return result;
+}
+
+// Opens a slot for key in its leaf and returns the leaf, with index set to the
+// slot. Returns nullptr if the key already exists, except in a multimap, where
+// index is set to the key's existing slot. The caller fills in the value and
+// splits the leaf if it is over-full.
+Node* BPlusTree::insertKey(int key, int& index) {
+    // Start with an empty root leaf if the tree is empty
+    if (!root) {
+        root = newNode(true);
+    }
+
+    // Find the leaf with the designated key, copying any node on the way
+    // that a snapshot shares and counting the new key
+    Node* leaf = findLeafForWrite(key, 1);
+
+    // Return nullptr if the key already exists in the leaf, or in a multimap
+    // the key's entry to append to
+    countSearch(leaf);
+    int* keys = leaf->keys();
+    int i = NodeSearch::lowerBound(keys, leaf->numKeys, key);
+    if (i < leaf->numKeys && keys[i] == key) {
+        addToCounts(-1);
+        index = i;
+        return multimap ? leaf : nullptr;
+    }
+
+    // Shift everything from i one slot right and place the key at i
+    string* values = leaf->values();
+    move_backward(keys + i, keys + leaf->numKeys, keys + leaf->numKeys + 1);
+    move_backward(values + i, values + leaf->numKeys, values + leaf->numKeys + 1);
+    keys[i] = key;
+    leaf->numKeys++;
+
+    index = i;
+    return leaf;
+}
+
+Node* BPlusTree::findLeaf(int key) const {
+    Node* node = root;
+
+    // While not a leaf, follow the pointer to the right of every key <= key
+    while (!node->isLeaf) {
+        countSearch(node);
+        int i = NodeSearch::upperBound(node->keys(), node->numKeys, key);
+        node = node->children()[i];
+    }
 
     return node;
 }
 
-void BPlusTree::insertIntoLeaf(Node* leaf, int key, const string& value) {
-    int i = 0;
-    while (i < leaf->keys.size() && key > leaf->keys[i]) {i++;}
+// Like findLeaf, but first copies every node on the path that a snapshot
+// shares, so the leaf and all of its ancestors can be changed in place, and
+// records the path. The key counts on the way down are changed by delta, for
+// a key about to be inserted or removed; the caller puts them back if it
+// changes nothing.
+Node* BPlusTree::findLeafForWrite(int key, int delta) {
+    path.clear();
+    if (root->refCount.load(memory_order_acquire) > 1) {
+        unshare(root, -1, 0);
+    }
+
+    Node* node = root;
+    while (!node->isLeaf) {
+        countSearch(node);
+        int i = NodeSearch::upperBound(node->keys(), node->numKeys, key);
+        node->counts()[i] += delta;
+        path.push_back({node, i});
+        node = writableChild(path.size() - 1, i);
+    }
+
+    return node;
+}
+
+// Child index of the node at depth on the path, which can be changed in
+// place, made writable
+Node* BPlusTree::writableChild(int depth, int index) {
+    Node* child = path[depth].node->children()[index];
+    if (child->refCount.load(memory_order_acquire) == 1) return child;
+    return unshare(child, depth, index);
+}
+
+// Replaces a shared node, child index of the node at parentDepth on the path
+// (or the root if parentDepth is -1), with a private copy. The copy takes over
+// the node's place in the previous leaf's next link and in the compaction
+// queue. A snapshot never reads those, so they are updated even on nodes it
+// shares.
+Node* BPlusTree::unshare(Node* node, int parentDepth, int index) {
+    Node* copy = newNode(node->isLeaf);
+    copy->numKeys = node->numKeys;
+    std::copy(node->keys(), node->keys() + node->numKeys, copy->keys());
+
+    if (node->isLeaf) {
+        std::copy(node->values(), node->values() + node->numKeys, copy->values());
+    } else {
+        for (int i = 0; i <= node->numKeys; i++) {
+            Node* child = node->children()[i];
+            child->refCount.fetch_add(1, memory_order_relaxed);
+            copy->children()[i] = child;
+        }
+        std::copy(node->counts(), node->counts() + node->numKeys + 1, copy->counts());
+        std::copy(node->aggregates(), node->aggregates() + node->numKeys + 1, copy->aggregates());
+    }
+
+    if (parentDepth >= 0) {
+        path[parentDepth].node->children()[index] = copy;
+    } else {
+        root = copy;
+    }
+
+    if (node->isLeaf) {
+        copy->next = node->next;
+
+        // The previous leaf is the last one under the nearest left sibling of an ancestor
+        for (int depth = parentDepth; depth >= 0; depth--) {
+            if (index > 0) {
+                Node* previous = path[depth].node->children()[index - 1];
+                while (!previous->isLeaf) {
+                    previous = previous->children()[previous->numKeys];
+                }
+                previous->next = copy;
+                break;
+            }
+            if (depth > 0) {index = path[depth - 1].childIndex;}
+        }
+
+        if (node->pendingIndex >= 0) {
+            copy->pendingIndex = node->pendingIndex;
+            pendingLeaves[copy->pendingIndex] = copy;
+            node->pendingIndex = -1;
+        }
+    }
 
-    // Place the key after the i-th element and before the (i+1)th element
-    leaf->keys.insert(leaf->keys.begin() + i, key);
-    leaf->pointers.insert(leaf->pointers.begin() + i, new string(value));
+    releaseNode(node);
+    return copy;
 }
 
 int ceilDivide(int a, int b) {
@@ -171,225 +715,647 @@ int ceilDivide(int a, int b) {
 
 
 void BPlusTree::splitLeaf(Node* leaf) {
-    Node* newLeaf = new Node(true);
+    statCounters.leafSplits.add();
+    Node* newLeaf = newNode(true);
     int leftLeafSize = ceilDivide(maxKeys + 1, 2);
-        
-    // Push all keys and records after left key to the new leaf
-    for (int i = leftLeafSize; i < leaf->keys.size(); i++) {
-        newLeaf->keys.push_back(leaf->keys[i]);
-        newLeaf->pointers.push_back(new string(*(static_cast<string*>(leaf->pointers[i]))));
-    }
+
+    // Move all keys and records after the left half to the new leaf
+    copy(leaf->keys() + leftLeafSize, leaf->keys() + leaf->numKeys, newLeaf->keys());
+    move(leaf->values() + leftLeafSize, leaf->values() + leaf->numKeys, newLeaf->values());
 
     // Shorten the original node
-    while (leaf->keys.size() > leftLeafSize) {
-        leaf->keys.pop_back();
-        leaf->pointers.pop_back();
-    }
+    newLeaf->numKeys = leaf->numKeys - leftLeafSize;
+    leaf->numKeys = leftLeafSize;
 
     // Redefine pointers
     newLeaf->next = leaf->next;
     leaf->next = newLeaf;
-    newLeaf->parent = leaf->parent;
 
-    // Insert the new key into the parent
-    insertIntoInterior(leaf->parent, newLeaf->keys.front(), leaf, newLeaf);
+    // Insert the new key into the parent, the last node on the path
+    insertIntoInterior(path.size(), newLeaf->keys()[0], leaf, newLeaf);
 }
 
 
 
 
-void BPlusTree::insertIntoInterior(Node* node, int key, Node* leftChild, Node* rightChild) {
+// Inserts key and rightChild, just split off leftChild, into the parent of
+// leftChild, a node at depth on the path
+void BPlusTree::insertIntoInterior(int depth, int key, Node* leftChild, Node* rightChild) {
     // Create parent if none exist
-    if (!node) {
-        root = new Node(false);
-        root->keys.push_back(key);
-        root->pointers.push_back(leftChild);
-        root->pointers.push_back(rightChild);
-        leftChild->parent = root;
-        rightChild->parent = root;
+    if (depth == 0) {
+        root = newNode(false);
+        root->keys()[0] = key;
+        root->children()[0] = leftChild;
+        root->children()[1] = rightChild;
+        root->numKeys = 1;
+        summarizeChild(root, 0);
+        summarizeChild(root, 1);
     } else {
-        // Insert the key and 
-        int i = 0;
-        while (i < node->keys.size() && key > node->keys[i]) {i++;}
-        node->keys.insert(node->keys.begin() + i, key);
-        node->pointers.insert(node->pointers.begin() + i + 1, rightChild);     
-
-        rightChild->parent = node;
+        // Insert the key and the new child to the right of leftChild
+        Node* node = path[depth - 1].node;
+        int* keys = node->keys();
+        Node** children = node->children();
+        uint64_t* counts = node->counts();
+        long long* aggregates = node->aggregates();
+        int i = path[depth - 1].childIndex;
+        move_backward(keys + i, keys + node->numKeys, keys + node->numKeys + 1);
+        move_backward(children + i + 1, children + node->numKeys + 1, children + node->numKeys + 2);
+        move_backward(counts + i + 1, counts + node->numKeys + 1, counts + node->numKeys + 2);
+        move_backward(aggregates + i + 1, aggregates + node->numKeys + 1, aggregates + node->numKeys + 2);
+        keys[i] = key;
+        children[i + 1] = rightChild;
+        node->numKeys++;
+
+        // rightChild takes its keys out of leftChild's count, which may also
+        // hold keys of a batch not yet in the tree
+        counts[i + 1] = subtreeCount(rightChild);
+        counts[i] -= counts[i + 1];
+        if (aggregator.measure) {
+            aggregates[i] = subtreeAggregate(leftChild);
+            aggregates[i + 1] = subtreeAggregate(rightChild);
+        }
 
         // Split interior if too large
-        if (node->keys.size() > maxKeys) {
-            splitInterior(node);
+        if (node->numKeys > maxKeys) {
+            splitInterior(depth - 1);
         }
     }
 }
 
-void BPlusTree::splitInterior(Node* interior) {
-    Node* newInterior = new Node(false);
-    int middleIndex = ceilDivide(maxKeys + 1, 2);
+void BPlusTree::splitInterior(int depth) {
+    statCounters.interiorSplits.add();
+    Node* interior = path[depth].node;
+    Node* newInterior = newNode(false);
+    int middleIndex = (maxKeys + 1) / 2; // Leaves floor(maxKeys / 2) keys on both sides
+    int middleKey = interior->keys()[middleIndex];
 
+    // Move all keys and children after the middle key to the new node
+    copy(interior->keys() + middleIndex + 1, interior->keys() + interior->numKeys, newInterior->keys());
+    copy(interior->children() + middleIndex + 1, interior->children() + interior->numKeys + 1, newInterior->children());
+    copy(interior->counts() + middleIndex + 1, interior->counts() + interior->numKeys + 1, newInterior->counts());
+    copy(interior->aggregates() + middleIndex + 1, interior->aggregates() + interior->numKeys + 1, newInterior->aggregates());
+    newInterior->numKeys = interior->numKeys - middleIndex - 1;
+
+    // Shorten the original node
+    interior->numKeys = middleIndex;
+
+    // Insert the middle key into the parent, along with the new node pointer
+    insertIntoInterior(depth, middleKey, interior, newInterior);
+}
+
+// Number of nodes to spread count entries over so that each node holds at most
+// perNode entries and none holds fewer than minPerNode.
+int nodesForLevel(int count, int perNode, int minPerNode) {
+    int numNodes = ceilDivide(count, perNode);
+    while (numNodes > 1 && count / numNodes < minPerNode) {numNodes--;}
+    return numNodes;
+}
 
-    // Push all children after midKey to the new node
-    for (int i = middleIndex + 1; i < interior->keys.size(); i++) {
-        newInterior->keys.push_back(interior->keys[i]);
-        newInterior->pointers.push_back(interior->pointers[i]);
+void BPlusTree::bulkLoad(const vector<pair<int, string>>& sortedPairs, double fillFactor) {
+    if (sortedPairs.empty()) return;
+
+    // Fall back to ordinary inserts if the keys are not strictly increasing
+    for (size_t i = 1; i < sortedPairs.size(); i++) {
+        if (sortedPairs[i - 1].first >= sortedPairs[i].first) {
+            for (const auto& entry : sortedPairs) {
+                insert(entry.first, entry.second);
+            }
+            return;
+        }
     }
-    newInterior->pointers.push_back(interior->pointers.back()); // including the last child
 
+    if (!(fillFactor > 0.0) || fillFactor > 1.0) {fillFactor = 1.0;}
+
+    // Pack the leaves, spreading the keys evenly so the last leaf is not under-full
+    int count = sortedPairs.size();
+    int minLeafKeys = ceilDivide(maxKeys, 2);
+    int leafKeys = max(minLeafKeys, min(maxKeys, (int)(maxKeys * fillFactor + 0.5)));
+    int numLeaves = nodesForLevel(count, leafKeys, minLeafKeys);
+
+    vector<Node*> level;
+    vector<int> lowestKeys; // Smallest key under each node of the current level
+    level.reserve(numLeaves);
+    lowestKeys.reserve(numLeaves);
+
+    int entry = 0;
+    Node* previousLeaf = nullptr;
+    for (int i = 0; i < numLeaves; i++) {
+        Node* leaf = newNode(true);
+        leaf->numKeys = count / numLeaves + (i < count % numLeaves ? 1 : 0);
+        for (int j = 0; j < leaf->numKeys; j++, entry++) {
+            leaf->keys()[j] = sortedPairs[entry].first;
+            leaf->values()[j] = sortedPairs[entry].second;
+        }
 
-    // Ensure child nodes point back to the correct parent node
-    for (auto ptr : newInterior->pointers) {
-        ((Node*)ptr)->parent = newInterior;
+        if (previousLeaf) {previousLeaf->next = leaf;}
+        previousLeaf = leaf;
+        level.push_back(leaf);
+        lowestKeys.push_back(leaf->keys()[0]);
     }
 
-    // Shorten the original node
-    while (interior->keys.size() > middleIndex) {
-        interior->keys.pop_back();
-        interior->pointers.pop_back();
+    buildInteriorLevels(level, lowestKeys, fillFactor);
+}
+
+// Builds each interior level from the one below until a single root remains.
+// lowestKeys holds the smallest key under each node of the level.
+void BPlusTree::buildInteriorLevels(vector<Node*>& level, vector<int>& lowestKeys, double fillFactor) {
+    int minChildren = maxKeys / 2 + 1;
+    int interiorChildren = max(minChildren, min(maxKeys + 1, (int)(maxKeys * fillFactor + 0.5) + 1));
+    while (level.size() > 1) {
+        int numChildren = level.size();
+        int numNodes = nodesForLevel(numChildren, interiorChildren, minChildren);
+
+        vector<Node*> parentLevel;
+        vector<int> parentLowestKeys;
+        parentLevel.reserve(numNodes);
+        parentLowestKeys.reserve(numNodes);
+
+        int child = 0;
+        for (int i = 0; i < numNodes; i++) {
+            Node* interior = newNode(false);
+            int nodeSize = numChildren / numNodes + (i < numChildren % numNodes ? 1 : 0);
+            parentLowestKeys.push_back(lowestKeys[child]);
+            for (int j = 0; j < nodeSize; j++, child++) {
+                // Every child after the first is separated by the smallest key beneath it
+                if (j > 0) {interior->keys()[j - 1] = lowestKeys[child];}
+                interior->children()[j] = level[child];
+                summarizeChild(interior, j);
+            }
+            interior->numKeys = nodeSize - 1;
+            parentLevel.push_back(interior);
+        }
+
+        level.swap(parentLevel);
+        lowestKeys.swap(parentLowestKeys);
     }
 
+    root = level.front();
+}
 
-    // Insert the middle key into the parent, along with the new node pointer
-    insertIntoInterior(interior->parent, interior->keys[middleIndex], interior, newInterior);
+
+const string& BPlusTree::find(int key) const {
+    static const string kMissing = "<empty>";
+    const string* value = get(key);
+    return value ? *value : kMissing;
 }
 
+const string* BPlusTree::get(int key) const {
+    LatencyTimer timer(latencies.get(), &TreeLatency::find);
+    statCounters.finds.add();
+    if (!root) return nullptr;
 
-string BPlusTree::find(int key) {
     // Starting from the root, find the leaf node that may contain the key
     Node* leaf = findLeaf(key);
 
     // Once at the leaf level, check if the key is present
-    for (int i = 0; i < leaf->keys.size(); i++) {
-        if (leaf->keys[i] == key) {
-            return *(static_cast<string*>(leaf->pointers[i])); // Dereference the pointer to return the actual string
-        }
+    countSearch(leaf);
+    int i = NodeSearch::lowerBound(leaf->keys(), leaf->numKeys, key);
+    if (i < leaf->numKeys && leaf->keys()[i] == key) {
+        return &leaf->values()[i];
     }
 
     // If the key wasn't found
-    return "<empty>";
+    return nullptr;
+}
+
+// Keys descended side by side by the batch operations
+const size_t kBatchLanes = 8;
+
+size_t BPlusTree::insertBatch(const vector<pair<int, string>>& pairs) {
+    statCounters.inserts.add(pairs.size());
+    if (pairs.empty()) return 0;
+
+    // Sort pointers so each value is copied only once, into its leaf
+    vector<const pair<int, string>*> sorted;
+    sorted.reserve(pairs.size());
+    for (const pair<int, string>& entry : pairs) {
+        sorted.push_back(&entry);
+    }
+    stable_sort(sorted.begin(), sorted.end(), [](const pair<int, string>* a, const pair<int, string>* b) {
+        return a->first < b->first;
+    });
+
+    // A multimap gathers each key's values into one list, in their order in
+    // pairs, and inserts the lists instead
+    vector<pair<int, string>> lists;
+    if (multimap) {
+        for (const pair<int, string>* entry : sorted) {
+            if (lists.empty() || lists.back().first != entry->first) {
+                lists.emplace_back(entry->first, string());
+            }
+            PostingList::append(lists.back().second, entry->second);
+        }
+        sorted.clear();
+        for (const pair<int, string>& list : lists) {
+            sorted.push_back(&list);
+        }
+    }
+
+    if (!root) {
+        root = newNode(true);
+    }
+
+    size_t inserted = 0;
+    vector<const pair<int, string>*> group;
+    vector<const pair<int, string>*> appends;  // Lists for keys a multimap already has
+    int laneKeys[kBatchLanes];
+    Node* leaves[kBatchLanes];
+    long long upperFences[kBatchLanes];
+    size_t i = 0;
+    while (i < sorted.size()) {
+        // Find the leaves of the next few keys together. Splitting one of them
+        // cannot move keys into another, so the later leaves stay valid.
+        size_t start = i;
+        size_t lanes = min(kBatchLanes, sorted.size() - start);
+        for (size_t lane = 0; lane < lanes; lane++) {
+            laneKeys[lane] = sorted[start + lane]->first;
+        }
+        findLeaves(laneKeys, lanes, leaves, upperFences);
+
+        for (size_t lane = 0; lane < lanes; lane++) {
+            if (start + lane < i) continue;  // Already taken by an earlier lane's leaf
+            Node* leaf = leaves[lane];
+
+            // Gather the keys that belong in this leaf and are not already there
+            group.clear();
+            for (; i < sorted.size() && sorted[i]->first < upperFences[lane]; i++) {
+                int key = sorted[i]->first;
+                if (!group.empty() && group.back()->first == key) continue;
+                countSearch(leaf);
+                int position = NodeSearch::lowerBound(leaf->keys(), leaf->numKeys, key);
+                if (position < leaf->numKeys && leaf->keys()[position] == key) {
+                    if (multimap) {appends.push_back(sorted[i]);}
+                    continue;
+                }
+                group.push_back(sorted[i]);
+            }
+
+            if (!group.empty()) {
+                insertGroup(findLeafForWrite(group.front()->first, group.size()), group);
+                inserted += group.size();
+            }
+        }
+    }
+
+    // Appending changes no key, so it waits until the new keys are in. Two
+    // encoded lists back to back are the list of all their values.
+    for (const pair<int, string>* entry : appends) {
+        Node* leaf = findLeafForWrite(entry->first, 0);
+        int position = NodeSearch::lowerBound(leaf->keys(), leaf->numKeys, entry->first);
+        leaf->values()[position].append(entry->second);
+        if (aggregator.measure) {
+            refreshAggregates();
+        }
+    }
+
+    return multimap ? pairs.size() : inserted;
+}
+
+// Starts the fetch of the start of a node: its header and first keys
+inline void prefetchNode(const Node* node) {
+#if defined(__GNUC__)
+    const char* bytes = reinterpret_cast<const char*>(node);
+    __builtin_prefetch(bytes);
+    __builtin_prefetch(bytes + 64);
+    __builtin_prefetch(bytes + 128);
+    __builtin_prefetch(bytes + 192);
+#else
+    (void)node;
+#endif
+}
+
+// Finds the leaves for up to kBatchLanes keys. Every leaf is at the same depth,
+// so the descents run in step, each prefetching its next node while the others
+// search theirs. A key's upper fence is the smallest separator above it: every
+// key below the fence that is not below this key also belongs in its leaf.
+void BPlusTree::findLeaves(const int* keys, size_t count, Node** leaves, long long* upperFences) const {
+    for (size_t lane = 0; lane < count; lane++) {
+        leaves[lane] = root;
+        if (upperFences) {upperFences[lane] = (long long)INT_MAX + 1;}
+    }
+
+    while (!leaves[0]->isLeaf) {
+        for (size_t lane = 0; lane < count; lane++) {
+            Node* node = leaves[lane];
+            countSearch(node);
+            int i = NodeSearch::upperBound(node->keys(), node->numKeys, keys[lane]);
+            if (upperFences && i < node->numKeys) {
+                upperFences[lane] = node->keys()[i];
+            }
+            leaves[lane] = node->children()[i];
+            prefetchNode(leaves[lane]);
+        }
+    }
+}
+
+// Merges sorted new keys into a leaf, then splits it into as many evenly
+// filled leaves as the result needs. The path must lead to the leaf, with the
+// new keys already counted along it.
+void BPlusTree::insertGroup(Node* leaf, const vector<const pair<int, string>*>& group) {
+    int* keys = leaf->keys();
+    string* values = leaf->values();
+    int total = leaf->numKeys + group.size();
+
+    if (total <= maxKeys) {
+        // Merge from the back so each existing entry moves at most once
+        int from = leaf->numKeys - 1;
+        int next = group.size() - 1;
+        for (int to = total - 1; next >= 0; to--) {
+            if (from >= 0 && keys[from] > group[next]->first) {
+                keys[to] = keys[from];
+                values[to] = move(values[from]);
+                from--;
+            } else {
+                keys[to] = group[next]->first;
+                values[to] = group[next]->second;
+                next--;
+            }
+        }
+        leaf->numKeys = total;
+        if (aggregator.measure) {
+            refreshAggregates();
+        }
+        return;
+    }
+
+    vector<int> mergedKeys;
+    vector<string> mergedValues;
+    mergedKeys.reserve(total);
+    mergedValues.reserve(total);
+    int from = 0;
+    for (const pair<int, string>* entry : group) {
+        while (from < leaf->numKeys && keys[from] < entry->first) {
+            mergedKeys.push_back(keys[from]);
+            mergedValues.push_back(move(values[from]));
+            from++;
+        }
+        mergedKeys.push_back(entry->first);
+        mergedValues.push_back(entry->second);
+    }
+    for (; from < leaf->numKeys; from++) {
+        mergedKeys.push_back(keys[from]);
+        mergedValues.push_back(move(values[from]));
+    }
+
+    // Spread the keys evenly; with at least two leaves none falls under the minimum
+    int numLeaves = ceilDivide(total, maxKeys);
+    vector<Node*> filled;
+    filled.reserve(numLeaves);
+    int position = 0;
+    for (int l = 0; l < numLeaves; l++) {
+        int count = total / numLeaves + (l < total % numLeaves ? 1 : 0);
+        Node* target = l > 0 ? newNode(true) : leaf;
+        copy(mergedKeys.begin() + position, mergedKeys.begin() + position + count, target->keys());
+        move(mergedValues.begin() + position, mergedValues.begin() + position + count, target->values());
+        target->numKeys = count;
+        position += count;
+
+        if (l > 0) {
+            target->next = filled.back()->next;
+            filled.back()->next = target;
+        }
+        filled.push_back(target);
+    }
+
+    // Add the new leaves to the tree from the last, each just after the
+    // original leaf, so that each takes its keys out of the original leaf's
+    // count. A split above moves the leaf, so the path is found again. A root
+    // leaf first gets a parent of its own that counts every key.
+    if (path.empty()) {
+        root = newNode(false);
+        root->children()[0] = leaf;
+        root->counts()[0] = total;
+        path.push_back({root, 0});
+    }
+    int firstKey = leaf->keys()[0];
+    for (int l = numLeaves - 1; l > 0; l--) {
+        if (l < numLeaves - 1) {findLeafForWrite(firstKey, 0);}
+        statCounters.leafSplits.add();
+        insertIntoInterior(path.size(), filled[l]->keys()[0], leaf, filled[l]);
+    }
+
+    // Splits above were folded before every leaf was in, so refold the path
+    // to each new leaf
+    if (aggregator.measure) {
+        for (Node* target : filled) {
+            findLeafForWrite(target->keys()[0], 0);
+            refreshAggregates();
+        }
+    }
+}
+
+vector<string> BPlusTree::findBatch(const vector<int>& keys) {
+    statCounters.finds.add(keys.size());
+    vector<string> results;
+    results.reserve(keys.size());
+    if (!root) {
+        results.assign(keys.size(), "<empty>");
+        return results;
+    }
+
+    Node* leaves[kBatchLanes];
+    for (size_t start = 0; start < keys.size(); start += kBatchLanes) {
+        size_t lanes = min(kBatchLanes, keys.size() - start);
+        findLeaves(keys.data() + start, lanes, leaves, nullptr);
+
+        for (size_t lane = 0; lane < lanes; lane++) {
+            Node* leaf = leaves[lane];
+            int key = keys[start + lane];
+            countSearch(leaf);
+            int i = NodeSearch::lowerBound(leaf->keys(), leaf->numKeys, key);
+            if (i < leaf->numKeys && leaf->keys()[i] == key) {
+                results.push_back(leaf->values()[i]);
+            } else {
+                results.push_back("<empty>");
+            }
+        }
+    }
+
+    return results;
 }
 
 bool BPlusTree::remove(int key) {
+    LatencyTimer timer(latencies.get(), &TreeLatency::remove);
+    statCounters.removes.add();
+    if (!root) return false;
+
     // Start from the root and find the leaf node that may contain the key
-    Node* leaf = findLeaf(key);
-    int keyIndex = -1;
+    Node* leaf = findLeafForWrite(key, -1);
 
     // Check if the key is present in the leaf
-    for (int i = 0; i < leaf->keys.size(); i++) {
-        if (leaf->keys[i] == key) {
-            keyIndex = i;
-            break;
-        }
-    }    
-    
+    countSearch(leaf);
+    int keyIndex = NodeSearch::lowerBound(leaf->keys(), leaf->numKeys, key);
+
     // If the key wasn't found, return false
-    if (keyIndex == -1) return false;
+    if (keyIndex == leaf->numKeys || leaf->keys()[keyIndex] != key) {
+        addToCounts(1);
+        return false;
+    }
 
-    // Delete the key and its associated pointer
-    delete static_cast<string*>(leaf->pointers[keyIndex]);
-    leaf->keys.erase(leaf->keys.begin() + keyIndex);
-    leaf->pointers.erase(leaf->pointers.begin() + keyIndex);
+    // Delete the key and its value, releasing the value's memory
+    int* keys = leaf->keys();
+    string* values = leaf->values();
+    move(keys + keyIndex + 1, keys + leaf->numKeys, keys + keyIndex);
+    move(values + keyIndex + 1, values + leaf->numKeys, values + keyIndex);
+    leaf->numKeys--;
+    string().swap(values[leaf->numKeys]);
+    if (aggregator.measure) {
+        refreshAggregates();
+    }
 
-    // Adjust the tree if necessary (e.g., merging nodes if underflow occurs)
-    adjustTreeAfterRemoval(leaf);
+    // In lazy mode an under-full leaf is queued for compact() unless it has
+    // dropped below the threshold; otherwise adjust the tree now
+    if (lazyDeletion && leaf != root && leaf->numKeys >= underflowThreshold) {
+        if (leaf->numKeys < ceilDivide(maxKeys, 2)) {
+            markForCompaction(leaf);
+        }
+    } else {
+        adjustTreeAfterRemoval(leaf, path.size());
+    }
 
     return true;
 }
 
-void BPlusTree::adjustTreeAfterRemoval(Node* node) {
+// Rebalances node, at depth on the path, then its ancestors as needed
+void BPlusTree::adjustTreeAfterRemoval(Node* node, int depth) {
     int minKeys;
     if(node->isLeaf){minKeys = ceilDivide(maxKeys, 2);} // ceiling(maxKeys / 2)
     else {minKeys = maxKeys / 2;} // floor(maxKeys / 2)
 
-    // Base case: if the node is the root or has enough entries, do nothing
-    if (node == root || node->keys.size() >= minKeys) return;
-
-    Node* parent = node->parent;
-    Node* leftSibling = nullptr;
-    Node* rightSibling = nullptr;
-    
-    // Refers to the key to the right of the pointer to the current node
-    int parentKeyIndex = 0;
-
-    // Find the node's index in its parent's pointers
-    for (int i = 0; i <= parent->keys.size(); i++) {
-        if (parent->pointers[i] == node) {
-            parentKeyIndex = i - 1;
-            // Assign leftSibling
-            if (i > 0) {leftSibling = static_cast<Node*>(parent->pointers[i - 1]);}
-            if (i < parent->keys.size()) {rightSibling = static_cast<Node*>(parent->pointers[i + 1]);}
-            break;
+    // Base case: the root may hold any number of keys, but shrinks the tree once it has none
+    if (node == root) {
+        if (node->numKeys == 0) {
+            root = node->isLeaf ? nullptr : node->children()[0];
+            freeNode(node);
         }
+        return;
     }
 
+    // Base case: the node has enough entries
+    if (node->numKeys >= minKeys) return;
+
+    Node* parent = path[depth - 1].node;
+    int index = path[depth - 1].childIndex;  // The node's index in its parent's pointers
+    Node* leftSibling = index > 0 ? parent->children()[index - 1] : nullptr;
+    Node* rightSibling = index < parent->numKeys ? parent->children()[index + 1] : nullptr;
+
+    // Refers to the key to the left of the pointer to the current node
+    int parentKeyIndex = index - 1;
+
+    int* keys = node->keys();
+
     // Borrow from sibling if possible
     if(node->isLeaf){
-        // Borrow from left sibling if it is large enough
-        if (leftSibling && leftSibling->keys.size() > minKeys) {
-            // Copy the last left sibling item to the start of the node
-            node->keys.insert(node->keys.begin(), leftSibling->keys.back());
-            node->pointers.insert(node->pointers.begin(), leftSibling->pointers.back());
+        string* values = node->values();
 
-            // Update the parent key
-            parent->keys[parentKeyIndex] = node->keys.front();
-
-            // Remove the borrowed key and pointer from the left sibling
-            leftSibling->keys.pop_back();
-            leftSibling->pointers.pop_back();
+        // Borrow from left sibling while it is large enough. A lazily
+        // compacted leaf can be several keys short, hence the loops.
+        if (leftSibling && leftSibling->numKeys > minKeys) {
+            leftSibling = writableChild(depth - 1, parentKeyIndex);
+        }
+        while (node->numKeys < minKeys && leftSibling && leftSibling->numKeys > minKeys) {
+            // Move the last left sibling item to the start of the node
+            int last = leftSibling->numKeys - 1;
+            move_backward(keys, keys + node->numKeys, keys + node->numKeys + 1);
+            move_backward(values, values + node->numKeys, values + node->numKeys + 1);
+            keys[0] = leftSibling->keys()[last];
+            values[0] = move(leftSibling->values()[last]);
+            node->numKeys++;
+            leftSibling->numKeys--;
+            statCounters.borrows.add();
 
-            return;
+            // Update the parent key
+            parent->keys()[parentKeyIndex] = keys[0];
         }
 
-        // Borrow from right sibling if it is large enough
-        if (rightSibling && rightSibling->keys.size() > minKeys) {
-            // Copy the first right sibling item to the end of the node
-            node->keys.push_back(rightSibling->keys.front());
-            node->pointers.push_back(rightSibling->pointers.front());
+        // Borrow from right sibling while it is large enough
+        if (node->numKeys < minKeys && rightSibling && rightSibling->numKeys > minKeys) {
+            rightSibling = writableChild(depth - 1, parentKeyIndex + 2);
+        }
+        while (node->numKeys < minKeys && rightSibling && rightSibling->numKeys > minKeys) {
+            // Move the first right sibling item to the end of the node
+            int* siblingKeys = rightSibling->keys();
+            string* siblingValues = rightSibling->values();
+            keys[node->numKeys] = siblingKeys[0];
+            values[node->numKeys] = move(siblingValues[0]);
+            node->numKeys++;
+
+            move(siblingKeys + 1, siblingKeys + rightSibling->numKeys, siblingKeys);
+            move(siblingValues + 1, siblingValues + rightSibling->numKeys, siblingValues);
+            rightSibling->numKeys--;
+            statCounters.borrows.add();
 
             // Update the sibling's parent key
-            parent->keys[parentKeyIndex + 1] = node->keys.front();
-
-            // Remove the borrowed key and pointer from the right sibling
-            rightSibling->keys.erase(rightSibling->keys.begin());
-            rightSibling->pointers.erase(rightSibling->pointers.begin());
-
-            return;
+            parent->keys()[parentKeyIndex + 1] = siblingKeys[0];
         }
 
-    } else {
-        // Borrowing from the left sibling for internal nodes
-        if (leftSibling && leftSibling->keys.size() > minKeys) {
-            // Prepend the shared parent key and the sibling's child
-            node->keys.insert(node->keys.begin(), parent->keys[parentKeyIndex]);
-            node->pointers.insert(node->pointers.begin(), leftSibling->pointers.back());
+        // Keys may have moved between the node and its siblings
+        summarizeChild(parent, parentKeyIndex + 1);
+        if (leftSibling) {summarizeChild(parent, parentKeyIndex);}
+        if (rightSibling) {summarizeChild(parent, parentKeyIndex + 2);}
 
-            // Update the parent key
-            parent->keys[parentKeyIndex] = leftSibling->keys.back();
+        if (node->numKeys >= minKeys) return;
 
-            // Remove the borrowed key and pointer from the left sibling
-            leftSibling->keys.pop_back();
-            leftSibling->pointers.pop_back();
+    } else {
+        Node** children = node->children();
+        uint64_t* counts = node->counts();
+        long long* aggregates = node->aggregates();
 
-            // Reassign parent of the borrowed pointer
-            static_cast<Node*>(node->pointers[0])->parent = node;
+        // Borrowing from the left sibling for internal nodes
+        if (leftSibling && leftSibling->numKeys > minKeys) {
+            leftSibling = writableChild(depth - 1, parentKeyIndex);
+
+            // Prepend the shared parent key and the sibling's last child
+            int last = leftSibling->numKeys;
+            move_backward(keys, keys + node->numKeys, keys + node->numKeys + 1);
+            move_backward(children, children + node->numKeys + 1, children + node->numKeys + 2);
+            move_backward(counts, counts + node->numKeys + 1, counts + node->numKeys + 2);
+            move_backward(aggregates, aggregates + node->numKeys + 1, aggregates + node->numKeys + 2);
+            keys[0] = parent->keys()[parentKeyIndex];
+            children[0] = leftSibling->children()[last];
+            counts[0] = leftSibling->counts()[last];
+            aggregates[0] = leftSibling->aggregates()[last];
+            node->numKeys++;
+
+            // Update the parent key and shorten the left sibling
+            parent->keys()[parentKeyIndex] = leftSibling->keys()[leftSibling->numKeys - 1];
+            leftSibling->numKeys--;
+
+            summarizeChild(parent, parentKeyIndex);
+            summarizeChild(parent, parentKeyIndex + 1);
+            statCounters.borrows.add();
 
             return;
         }
-        
+
         // Borrowing from the right sibling for internal nodes
-        if (rightSibling && rightSibling->keys.size() > minKeys) {
-            // Append the shared parent key and the sibling's child
-            node->keys.push_back(parent->keys[parentKeyIndex + 1]);
-            node->pointers.push_back(rightSibling->pointers[0]);
+        if (rightSibling && rightSibling->numKeys > minKeys) {
+            rightSibling = writableChild(depth - 1, parentKeyIndex + 2);
+
+            // Append the shared parent key and the sibling's first child
+            int* siblingKeys = rightSibling->keys();
+            Node** siblingChildren = rightSibling->children();
+            uint64_t* siblingCounts = rightSibling->counts();
+            long long* siblingAggregates = rightSibling->aggregates();
+            keys[node->numKeys] = parent->keys()[parentKeyIndex + 1];
+            children[node->numKeys + 1] = siblingChildren[0];
+            counts[node->numKeys + 1] = siblingCounts[0];
+            aggregates[node->numKeys + 1] = siblingAggregates[0];
+            node->numKeys++;
 
             // Update the sibling's parent key
-            parent->keys[parentKeyIndex + 1] = rightSibling->keys.front();
+            parent->keys()[parentKeyIndex + 1] = siblingKeys[0];
 
             // Remove the borrowed key and pointer from the right sibling
-            rightSibling->keys.erase(rightSibling->keys.begin());
-            rightSibling->pointers.erase(rightSibling->pointers.begin());
+            move(siblingKeys + 1, siblingKeys + rightSibling->numKeys, siblingKeys);
+            move(siblingChildren + 1, siblingChildren + rightSibling->numKeys + 1, siblingChildren);
+            move(siblingCounts + 1, siblingCounts + rightSibling->numKeys + 1, siblingCounts);
+            move(siblingAggregates + 1, siblingAggregates + rightSibling->numKeys + 1, siblingAggregates);
+            rightSibling->numKeys--;
 
-            // Reassign parent of the borrowed pointer
-            static_cast<Node*>(node->pointers.back())->parent = node;
+            summarizeChild(parent, parentKeyIndex + 1);
+            summarizeChild(parent, parentKeyIndex + 2);
+            statCounters.borrows.add();
 
             return;
         }
@@ -397,58 +1363,734 @@ void BPlusTree::adjustTreeAfterRemoval(Node* node) {
 
     // If borrowing is not possible, merge with a sibling
     if (leftSibling) {
-        mergeNodes(leftSibling, node);
-        adjustTreeAfterRemoval(parent);
+        leftSibling = writableChild(depth - 1, parentKeyIndex);
+        mergeNodes(parent, parentKeyIndex);
     } else if (rightSibling) {
-        mergeNodes(node, rightSibling);
-        adjustTreeAfterRemoval(parent); 
+        rightSibling = writableChild(depth - 1, parentKeyIndex + 2);
+        mergeNodes(parent, parentKeyIndex + 1);
     }
-}
+    Node* merged = leftSibling ? leftSibling : node;
 
-void BPlusTree::mergeNodes(Node* leftNode, Node* rightNode) {
-    // Find shared parent key index of both nodes.
-    Node* parent = leftNode->parent;
-    int parentKeyIndex = 0;
-    for (int i = 0; i < parent->keys.size(); i++) {
-        if (parent->pointers[i] == leftNode) {
-            parentKeyIndex = i;
-            break;
-        }
+    // Two under-full leaves left by lazy removes can merge into one that is still short
+    if (merged->isLeaf && merged->numKeys < minKeys) {
+        markForCompaction(merged);
     }
-    
-    // Copy data from the right node to the left node
+    adjustTreeAfterRemoval(parent, depth - 1);
+}
+
+// Merges children leftIndex and leftIndex + 1 of parent into the first
+void BPlusTree::mergeNodes(Node* parent, int leftIndex) {
+    Node* leftNode = parent->children()[leftIndex];
+    Node* rightNode = parent->children()[leftIndex + 1];
+    int parentKeyIndex = leftIndex;  // The key between the two nodes
+
+    (leftNode->isLeaf ? statCounters.leafMerges : statCounters.interiorMerges).add();
+
+    // Move data from the right node to the left node
+    int* leftKeys = leftNode->keys();
     if (leftNode->isLeaf) {
-        for (int i = 0; i < rightNode->keys.size(); i++) {
-            leftNode->keys.push_back(rightNode->keys[i]);
-            leftNode->pointers.push_back(rightNode->pointers[i]);
-        }
+        copy(rightNode->keys(), rightNode->keys() + rightNode->numKeys, leftKeys + leftNode->numKeys);
+        move(rightNode->values(), rightNode->values() + rightNode->numKeys, leftNode->values() + leftNode->numKeys);
+        leftNode->numKeys += rightNode->numKeys;
 
         // Update the next pointer of the left node
         leftNode->next = rightNode->next;
 
     } else { // If nodes are internal nodes
-        // Append the shared parent key to the leftNode 
-        leftNode->keys.push_back(parent->keys[parentKeyIndex]);
+        // Append the shared parent key to the leftNode
+        leftKeys[leftNode->numKeys] = parent->keys()[parentKeyIndex];
 
         // Append all keys and pointers form rightNode to leftNode
-        for (int i = 0; i < rightNode->keys.size(); i++) {
-            leftNode->keys.push_back(rightNode->keys[i]);
-            leftNode->pointers.push_back(rightNode->pointers[i]);
+        Node** movedChildren = leftNode->children() + leftNode->numKeys + 1;
+        copy(rightNode->keys(), rightNode->keys() + rightNode->numKeys, leftKeys + leftNode->numKeys + 1);
+        copy(rightNode->children(), rightNode->children() + rightNode->numKeys + 1, movedChildren);
+        copy(rightNode->counts(), rightNode->counts() + rightNode->numKeys + 1, leftNode->counts() + leftNode->numKeys + 1);
+        copy(rightNode->aggregates(), rightNode->aggregates() + rightNode->numKeys + 1, leftNode->aggregates() + leftNode->numKeys + 1);
+        leftNode->numKeys += rightNode->numKeys + 1;
+    }
+
+    // Remove the shared parent key and the pointer to the right node
+    int* parentKeys = parent->keys();
+    Node** parentChildren = parent->children();
+    uint64_t* parentCounts = parent->counts();
+    long long* parentAggregates = parent->aggregates();
+    move(parentKeys + parentKeyIndex + 1, parentKeys + parent->numKeys, parentKeys + parentKeyIndex);
+    move(parentChildren + parentKeyIndex + 2, parentChildren + parent->numKeys + 1, parentChildren + parentKeyIndex + 1);
+    move(parentCounts + parentKeyIndex + 2, parentCounts + parent->numKeys + 1, parentCounts + parentKeyIndex + 1);
+    move(parentAggregates + parentKeyIndex + 2, parentAggregates + parent->numKeys + 1, parentAggregates + parentKeyIndex + 1);
+    parent->numKeys--;
+    summarizeChild(parent, parentKeyIndex);
+
+    // Delete the right node
+    freeNode(rightNode);
+}
+
+void BPlusTree::setLazyDeletion(bool enabled, int threshold) {
+    lazyDeletion = enabled;
+    underflowThreshold = max(1, threshold);
+    if (!enabled) {
+        compact(pendingLeaves.size());
+    }
+}
+
+bool BPlusTree::setMultimap(bool enabled) {
+    if (size() > 0) return false;
+    multimap = enabled;
+    return true;
+}
+
+BPlusTree::PostingList BPlusTree::findAll(int key) const {
+    const string* list = get(key);
+    return list ? PostingList(*list) : PostingList();
+}
+
+// Reads the value at position, or stops at the end of the list if it is cut short
+BPlusTree::PostingList::Iterator::Iterator(const char* position, const char* end) :
+    position(position),
+    end(end)
+{
+    uint32_t length = 0;
+    const char* next = position;
+    for (int shift = 0; next < end; shift += 7) {
+        uint8_t byte = *next++;
+        length |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            if (length <= (size_t)(end - next)) {
+                value = string_view(next, length);
+                return;
+            }
+            break;
+        }
+        if (shift == 28) break;
+    }
+    this->position = end;
+}
+
+BPlusTree::PostingList::Iterator& BPlusTree::PostingList::Iterator::operator++() {
+    *this = Iterator(value.data() + value.size(), end);
+    return *this;
+}
+
+size_t BPlusTree::PostingList::size() const {
+    size_t count = 0;
+    for (Iterator it = begin(); it != end(); ++it) {
+        count++;
+    }
+    return count;
+}
+
+void BPlusTree::PostingList::append(string& encoded, string_view value) {
+    uint32_t length = value.size();
+    while (length >= 0x80) {
+        encoded.push_back((char)(length | 0x80));
+        length >>= 7;
+    }
+    encoded.push_back((char)length);
+    encoded.append(value.data(), value.size());
+}
+
+size_t BPlusTree::compact(size_t maxLeaves) {
+    for (size_t processed = 0; processed < maxLeaves && !pendingLeaves.empty(); processed++) {
+        Node* leaf = pendingLeaves.back();
+        unmarkForCompaction(leaf);
+
+        // Find the leaf again by its first key, for the path to rebalance along
+        leaf = findLeafForWrite(leaf->keys()[0], 0);
+        adjustTreeAfterRemoval(leaf, path.size());
+    }
+    return pendingLeaves.size();
+}
+
+void BPlusTree::markForCompaction(Node* leaf) {
+    if (leaf->pendingIndex >= 0) return;
+    leaf->pendingIndex = pendingLeaves.size();
+    pendingLeaves.push_back(leaf);
+}
+
+// Removes a leaf from the queue by moving the last queued leaf into its place
+void BPlusTree::unmarkForCompaction(Node* leaf) {
+    Node* last = pendingLeaves.back();
+    pendingLeaves[leaf->pendingIndex] = last;
+    last->pendingIndex = leaf->pendingIndex;
+    pendingLeaves.pop_back();
+    leaf->pendingIndex = -1;
+}
+
+// Counts one node search on the way to or within a leaf
+void BPlusTree::countSearch(const Node* node) const {
+    if (kTreeStatsEnabled) {
+        statCounters.nodesVisited.add();
+        statCounters.keyComparisons.add(NodeSearch::comparisons(node->numKeys));
+    }
+}
+
+void BPlusTree::resetCounters() {
+    TreeCounters fresh;
+    fresh.leafNodes = statCounters.leafNodes;
+    fresh.interiorNodes = statCounters.interiorNodes;
+    statCounters = fresh;
+    if (latencies) {
+        latencies->insert.reset();
+        latencies->find.reset();
+        latencies->remove.reset();
+    }
+}
+
+TreeStats BPlusTree::stats() const {
+    TreeStats result;
+    result.counters = statCounters;
+    result.pendingCompaction = pendingLeaves.size();
+    if (!root) return result;
+
+    // Walk the tree a level at a time
+    vector<const Node*> level = {root};
+    while (!level.empty()) {
+        size_t levelKeys = 0;
+        vector<const Node*> nextLevel;
+        for (const Node* node : level) {
+            levelKeys += node->numKeys;
+            if (!node->isLeaf) {
+                nextLevel.insert(nextLevel.end(), node->children(), node->children() + node->numKeys + 1);
+            }
         }
-        leftNode->pointers.push_back(rightNode->pointers.back());
 
-        // Update the parent pointers of moved children
-        for (auto& ptr : leftNode->pointers) {
-            static_cast<Node*>(ptr)->parent = leftNode;
+        double fill = (double)levelKeys / ((double)level.size() * maxKeys);
+        result.height++;
+        result.levelNodes.push_back(level.size());
+        result.levelFill.push_back(fill);
+        if (level.front()->isLeaf) {
+            result.numKeys = levelKeys;
+            result.leafNodes = level.size();
+            result.leafFill = fill;
+        } else {
+            result.interiorNodes += level.size();
         }
+        level.swap(nextLevel);
     }
 
-    // Remove the shared parent key
-    parent->keys.erase(parent->keys.begin() + parentKeyIndex);
-    
-    // Delete the right node
-    parent->pointers.erase(parent->pointers.begin() + parentKeyIndex + 1);
-    delete rightNode;
+    return result;
+}
+
+// Empties the compaction queue without compacting. Called before the tree lets
+// go of its nodes, since some may live on in snapshots.
+void BPlusTree::clearCompactionQueue() {
+    for (Node* leaf : pendingLeaves) {
+        leaf->pendingIndex = -1;
+    }
+    pendingLeaves.clear();
+}
+
+uint64_t BPlusTree::subtreeCount(const Node* node) {
+    if (node->isLeaf) return node->numKeys;
+    uint64_t count = 0;
+    for (int i = 0; i <= node->numKeys; i++) {
+        count += node->counts()[i];
+    }
+    return count;
+}
+
+long long BPlusTree::subtreeAggregate(const Node* node) const {
+    if (node->isLeaf) return foldEntries(node, 0, node->numKeys);
+    long long result = aggregator.identity;
+    for (int i = 0; i <= node->numKeys; i++) {
+        result = aggregator.combine(result, node->aggregates()[i]);
+    }
+    return result;
+}
+
+// Folds the measures of entries [first, last) of a leaf
+long long BPlusTree::foldEntries(const Node* leaf, int first, int last) const {
+    long long result = aggregator.identity;
+    for (int i = first; i < last; i++) {
+        result = aggregator.combine(result, aggregator.measure(leaf->keys()[i], leaf->values()[i]));
+    }
+    return result;
+}
+
+// Recomputes every aggregate under node and returns node's own
+long long BPlusTree::computeAggregates(Node* node) {
+    if (node->isLeaf) return foldEntries(node, 0, node->numKeys);
+    long long result = aggregator.identity;
+    for (int i = 0; i <= node->numKeys; i++) {
+        node->aggregates()[i] = computeAggregates(node->children()[i]);
+        result = aggregator.combine(result, node->aggregates()[i]);
+    }
+    return result;
+}
+
+// Recomputes parent's count and aggregate for child index from the child itself
+void BPlusTree::summarizeChild(Node* parent, int index) {
+    const Node* child = parent->children()[index];
+    parent->counts()[index] = subtreeCount(child);
+    if (aggregator.measure) {
+        parent->aggregates()[index] = subtreeAggregate(child);
+    }
+}
+
+// Adds delta to the count of every child the path takes
+void BPlusTree::addToCounts(int64_t delta) {
+    for (const PathStep& step : path) {
+        step.node->counts()[step.childIndex] += delta;
+    }
+}
+
+// Refolds the aggregates along the path, from the bottom, after its leaf changed
+void BPlusTree::refreshAggregates() {
+    for (size_t depth = path.size(); depth-- > 0;) {
+        Node* parent = path[depth].node;
+        int index = path[depth].childIndex;
+        parent->aggregates()[index] = subtreeAggregate(parent->children()[index]);
+    }
+}
+
+// Keys less than key, or no greater than it if inclusive
+size_t BPlusTree::countBelow(int key, bool inclusive) const {
+    if (!root) return 0;
+    size_t count = 0;
+    const Node* node = root;
+    while (!node->isLeaf) {
+        countSearch(node);
+        int i = NodeSearch::upperBound(node->keys(), node->numKeys, key);
+        for (int j = 0; j < i; j++) {
+            count += node->counts()[j];
+        }
+        node = node->children()[i];
+    }
+    countSearch(node);
+    if (inclusive) return count + NodeSearch::upperBound(node->keys(), node->numKeys, key);
+    return count + NodeSearch::lowerBound(node->keys(), node->numKeys, key);
+}
+
+size_t BPlusTree::rank(int key) const {
+    return countBelow(key, false);
+}
+
+size_t BPlusTree::countRange(int lo, int hi) const {
+    if (lo > hi) return 0;
+    return countBelow(hi, true) - countBelow(lo, false);
+}
+
+BPlusTree::Iterator BPlusTree::select(size_t position) const {
+    if (position >= size()) return end();
+    Node* node = root;
+    while (!node->isLeaf) {
+        int i = 0;
+        while (position >= node->counts()[i]) {
+            position -= node->counts()[i];
+            i++;
+        }
+        node = node->children()[i];
+    }
+    return Iterator(node, position);
+}
+
+void BPlusTree::setAggregate(const TreeAggregate& aggregate) {
+    aggregator = aggregate;
+    if (aggregator.measure && root) {
+        computeAggregates(root);
+    }
+}
+
+long long BPlusTree::aggregate(int lo, int hi) const {
+    if (!aggregator.measure || !root || lo > hi) return aggregator.identity;
+    return foldRange(root, lo, hi, true, true);
+}
+
+// Folds the entries of node in [lo, hi]. Only the bounds that cut through node
+// are passed on, so the children between the two boundary paths are folded
+// from their stored aggregates.
+long long BPlusTree::foldRange(const Node* node, int lo, int hi, bool boundedLow, bool boundedHigh) const {
+    if (!boundedLow && !boundedHigh) return subtreeAggregate(node);
+    if (node->isLeaf) {
+        int first = boundedLow ? NodeSearch::lowerBound(node->keys(), node->numKeys, lo) : 0;
+        int last = boundedHigh ? NodeSearch::upperBound(node->keys(), node->numKeys, hi) : node->numKeys;
+        return foldEntries(node, first, last);
+    }
+
+    int first = boundedLow ? NodeSearch::upperBound(node->keys(), node->numKeys, lo) : 0;
+    int last = boundedHigh ? NodeSearch::upperBound(node->keys(), node->numKeys, hi) : node->numKeys;
+    if (first == last) return foldRange(node->children()[first], lo, hi, boundedLow, boundedHigh);
+    long long result = foldRange(node->children()[first], lo, hi, boundedLow, false);
+    for (int i = first + 1; i < last; i++) {
+        result = aggregator.combine(result, node->aggregates()[i]);
+    }
+    return aggregator.combine(result, foldRange(node->children()[last], lo, hi, false, boundedHigh));
+}
+
+BPlusTree::Iterator::Iterator(Node* leaf, int index) : leaf(leaf), index(index) {
+    // Step over the end of a leaf onto the first key of the next one
+    while (this->leaf && this->index >= this->leaf->numKeys) {
+        this->leaf = this->leaf->next;
+        this->index = 0;
+    }
+}
+
+BPlusTree::Iterator& BPlusTree::Iterator::operator++() {
+    *this = Iterator(leaf, index + 1);
+    return *this;
+}
+
+BPlusTree::Iterator BPlusTree::begin() const {
+    if (!root) return end();
+
+    // Go down to the first leaf node (leftmost)
+    Node* node = root;
+    while (!node->isLeaf) {
+        node = node->children()[0];
+    }
+    return Iterator(node, 0);
+}
+
+BPlusTree::Iterator BPlusTree::end() const {
+    return Iterator(nullptr, 0);
+}
+
+BPlusTree::Iterator BPlusTree::lowerBound(int key) const {
+    if (!root) return end();
+    Node* leaf = findLeaf(key);
+    return Iterator(leaf, NodeSearch::lowerBound(leaf->keys(), leaf->numKeys, key));
+}
+
+BPlusTree::Iterator BPlusTree::upperBound(int key) const {
+    if (!root) return end();
+    Node* leaf = findLeaf(key);
+    return Iterator(leaf, NodeSearch::upperBound(leaf->keys(), leaf->numKeys, key));
+}
+
+// Snapshot layout, in the machine's byte order:
+//   header: SnapshotHeader
+//   body:   the number of keys in each leaf, left to right (varints)
+//           each key minus the one before it, modulo 2^32 (varints)
+//           the length of each value (varints)
+//           every value's bytes, back to back
+// The checksum covers the body.
+namespace {
+
+const char kSnapshotMagic[8] = {'B', 'P', 'T', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t kSnapshotVersion = 2;
+const uint32_t kSnapshotMultimap = 1;  // Values are posting lists
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxKeys;
+    uint32_t flags;
+    uint32_t reserved;  // Zero
+    uint64_t numKeys;
+    uint64_t numLeaves;
+    uint64_t bodyBytes;
+    uint64_t checksum;
+};
+
+void appendVarint(string& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+// Reads the varint at position and moves past it; false if it runs off the end
+bool readVarint(const string& bytes, size_t& position, uint32_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (position >= bytes.size()) return false;
+        uint8_t byte = bytes[position++];
+        value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Multiply-rotate hash over 8-byte words, so checking a large snapshot costs
+// little next to reading it
+uint64_t snapshotChecksum(const char* bytes, size_t size) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash ^= word * 0xBF58476D1CE4E5B9ull;
+        hash = ((hash << 31) | (hash >> 33)) * 0x94D049BB133111EBull;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes + i, size - i);
+    hash ^= tail * 0xBF58476D1CE4E5B9ull;
+    return hash ^ (hash >> 29);
+}
+
+}  // namespace
+
+bool BPlusTree::save(const string& path) const {
+    string leafSizes;
+    string keyDeltas;
+    string lengths;
+    string heap;
+    uint64_t numKeys = 0;
+    uint64_t numLeaves = 0;
+
+    const Node* firstLeaf = root;
+    while (firstLeaf && !firstLeaf->isLeaf) {
+        firstLeaf = firstLeaf->children()[0];
+    }
+
+    uint32_t previous = 0;
+    vector<int> sizes;
+    bool underFull = false;
+    for (const Node* leaf = firstLeaf; leaf; leaf = leaf->next) {
+        if (leaf->numKeys == 0) continue;
+        sizes.push_back(leaf->numKeys);
+        underFull = underFull || leaf->numKeys < ceilDivide(maxKeys, 2);
+        for (int i = 0; i < leaf->numKeys; i++) {
+            const string& value = leaf->values()[i];
+            if (value.size() > UINT32_MAX) return false;
+            appendVarint(keyDeltas, (uint32_t)leaf->keys()[i] - previous);
+            appendVarint(lengths, value.size());
+            heap.append(value);
+            previous = leaf->keys()[i];
+        }
+        numKeys += leaf->numKeys;
+    }
+
+    // Lazy deletion can leave leaves under-full; write those as if compacted,
+    // spreading the keys evenly as bulkLoad does, so load() accepts the snapshot
+    if (underFull && sizes.size() > 1) {
+        int count = numKeys;
+        int numNodes = nodesForLevel(count, maxKeys, ceilDivide(maxKeys, 2));
+        sizes.assign(numNodes, count / numNodes);
+        for (int i = 0; i < count % numNodes; i++) {sizes[i]++;}
+    }
+    for (int size : sizes) {
+        appendVarint(leafSizes, size);
+    }
+    numLeaves = sizes.size();
+
+    string body;
+    body.reserve(leafSizes.size() + keyDeltas.size() + lengths.size() + heap.size());
+    body.append(leafSizes).append(keyDeltas).append(lengths).append(heap);
+
+    SnapshotHeader header;
+    memcpy(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic));
+    header.version = kSnapshotVersion;
+    header.maxKeys = maxKeys;
+    header.flags = multimap ? kSnapshotMultimap : 0;
+    header.reserved = 0;
+    header.numKeys = numKeys;
+    header.numLeaves = numLeaves;
+    header.bodyBytes = body.size();
+    header.checksum = snapshotChecksum(body.data(), body.size());
+
+    // Write a temporary file first so a failed save leaves the old snapshot intact
+    string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if (!file) return false;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+                   && fwrite(body.data(), 1, body.size(), file) == body.size();
+    written = fclose(file) == 0 && written;
+    if (written && rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        // Some platforms will not rename over an existing file
+        std::remove(path.c_str());
+        written = rename(temporaryPath.c_str(), path.c_str()) == 0;
+    }
+    if (!written) {
+        std::remove(temporaryPath.c_str());
+    }
+    return written;
+}
+
+bool BPlusTree::load(const string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+
+    SnapshotHeader header;
+    string body;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+                 && memcmp(header.magic, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0
+                 && header.version == kSnapshotVersion
+                 && (header.flags & ~kSnapshotMultimap) == 0
+                 && header.maxKeys >= 2 && header.maxKeys <= (1u << 20);
+    if (valid) {
+        // Size the body from the file so a damaged header cannot ask for too much memory
+        long start = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, start, SEEK_SET);
+        valid = start >= 0 && end - start >= 0 && (uint64_t)(end - start) == header.bodyBytes;
+    }
+    if (valid) {
+        body.resize(header.bodyBytes);
+        valid = fread(&body[0], 1, body.size(), file) == body.size()
+                && snapshotChecksum(body.data(), body.size()) == header.checksum;
+    }
+    fclose(file);
+
+    // Every key takes at least two bytes of the body, which bounds the counts below
+    if (!valid || header.numLeaves > header.numKeys || header.numKeys > body.size() / 2) return false;
+
+    // Decode and check everything before touching the tree
+    int savedMaxKeys = header.maxKeys;
+    int minLeafKeys = header.numLeaves > 1 ? ceilDivide(savedMaxKeys, 2) : 1;
+    size_t position = 0;
+    vector<int> leafSizes(header.numLeaves);
+    uint64_t totalKeys = 0;
+    for (int& size : leafSizes) {
+        uint32_t value;
+        if (!readVarint(body, position, value) || (int)value < minLeafKeys || (int)value > savedMaxKeys) return false;
+        size = value;
+        totalKeys += value;
+    }
+    if (totalKeys != header.numKeys) return false;
+
+    vector<int> keys(header.numKeys);
+    uint32_t previous = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        uint32_t delta;
+        if (!readVarint(body, position, delta)) return false;
+        previous += delta;
+        keys[i] = (int)previous;
+        if (i > 0 && keys[i - 1] >= keys[i]) return false;
+    }
+
+    vector<uint32_t> lengths(header.numKeys);
+    uint64_t heapBytes = 0;
+    for (uint32_t& length : lengths) {
+        if (!readVarint(body, position, length)) return false;
+        heapBytes += length;
+    }
+    if (heapBytes != body.size() - position) return false;
+
+    // Replace the tree: fill the leaves exactly as they were saved, then build upwards
+    clearCompactionQueue();
+    destroyTree(root);
+    root = nullptr;
+    maxKeys = savedMaxKeys;
+    multimap = (header.flags & kSnapshotMultimap) != 0;
+    resetStore();
+    if (keys.empty()) return true;
+
+    vector<Node*> level;
+    vector<int> lowestKeys;
+    level.reserve(leafSizes.size());
+    lowestKeys.reserve(leafSizes.size());
+    const char* heap = body.data() + position;
+    size_t entry = 0;
+    Node* previousLeaf = nullptr;
+    for (int size : leafSizes) {
+        Node* leaf = newNode(true);
+        for (int j = 0; j < size; j++, entry++) {
+            leaf->keys()[j] = keys[entry];
+            leaf->values()[j].assign(heap, lengths[entry]);
+            heap += lengths[entry];
+        }
+        leaf->numKeys = size;
+
+        if (previousLeaf) {previousLeaf->next = leaf;}
+        previousLeaf = leaf;
+        level.push_back(leaf);
+        lowestKeys.push_back(leaf->keys()[0]);
+    }
+
+    buildInteriorLevels(level, lowestKeys, 1.0);
+    return true;
+}
+
+BPlusTree::Snapshot BPlusTree::snapshot() const {
+    if (root) {root->refCount.fetch_add(1, memory_order_relaxed);}
+    return Snapshot(store, root);
+}
+
+// Snapshot copy constructor
+BPlusTree::Snapshot::Snapshot(const Snapshot& other) : store(other.store), root(other.root) {
+    if (root) {root->refCount.fetch_add(1, memory_order_relaxed);}
+}
+
+// Snapshot move constructor
+BPlusTree::Snapshot::Snapshot(Snapshot&& other) noexcept : store(move(other.store)), root(other.root) {
+    other.root = nullptr;
+}
+
+BPlusTree::Snapshot& BPlusTree::Snapshot::operator=(Snapshot other) noexcept {
+    swap(store, other.store);
+    swap(root, other.root);
+    return *this;
+}
+
+// Snapshot release
+BPlusTree::Snapshot::~Snapshot() {
+    if (!root) return;
+    vector<pair<void*, bool>> freed;
+    release(*store, root, freed);
+    if (freed.empty()) return;
+
+    // The arenas belong to the tree's thread, which takes the blocks back later
+    lock_guard<mutex> lock(store->retiredMutex);
+    store->retired.insert(store->retired.end(), freed.begin(), freed.end());
+    store->hasRetired.store(true, memory_order_release);
+}
+
+// Drops one reference to node, destroying it and then its children once
+// nothing else points at it, and collecting the freed blocks
+void BPlusTree::Snapshot::release(NodeStore& store, Node* node, vector<pair<void*, bool>>& freed) {
+    if (node->refCount.fetch_sub(1, memory_order_acq_rel) != 1) return;
+
+    if (!node->isLeaf) {
+        for (int i = 0; i <= node->numKeys; i++) {
+            release(store, node->children()[i], freed);
+        }
+    }
+    bool isLeaf = node->isLeaf;
+    node->~Node();
+    freed.push_back({node, isLeaf});
+}
+
+const string& BPlusTree::Snapshot::find(int key) const {
+    static const string kMissing = "<empty>";
+    const string* value = get(key);
+    return value ? *value : kMissing;
+}
+
+const string* BPlusTree::Snapshot::get(int key) const {
+    if (!root) return nullptr;
+    const Node* node = root;
+    while (!node->isLeaf) {
+        node = node->children()[NodeSearch::upperBound(node->keys(), node->numKeys, key)];
+    }
+    int i = NodeSearch::lowerBound(node->keys(), node->numKeys, key);
+    if (i < node->numKeys && node->keys()[i] == key) {
+        return &node->values()[i];
+    }
+    return nullptr;
+}
+
+// Descends to the leaf that would hold key, recording each interior node and
+// the child taken, and sets index to the first key >= key in that leaf
+const Node* BPlusTree::Snapshot::seek(int key, vector<pair<const Node*, int>>& path, int& index) const {
+    index = 0;
+    if (!root) return nullptr;
+    const Node* node = root;
+    while (!node->isLeaf) {
+        int i = NodeSearch::upperBound(node->keys(), node->numKeys, key);
+        path.push_back({node, i});
+        node = node->children()[i];
+    }
+    index = NodeSearch::lowerBound(node->keys(), node->numKeys, key);
+    return node;
+}
+
+// The leaf after the one path leads to: up to the nearest ancestor with a
+// child further right, then down that child's left edge
+const Node* BPlusTree::Snapshot::nextLeaf(vector<pair<const Node*, int>>& path) {
+    while (!path.empty() && path.back().second == path.back().first->numKeys) {
+        path.pop_back();
+    }
+    if (path.empty()) return nullptr;
+
+    const Node* node = path.back().first->children()[++path.back().second];
+    while (!node->isLeaf) {
+        path.push_back({node, 0});
+        node = node->children()[0];
+    }
+    return node;
 }
 
 // Uses breadth-first-search.
@@ -462,32 +2104,32 @@ void BPlusTree::printKeys() {
     // Use a queue to keep track of nodes to visit
     queue<Node*> nodesToVisit;
     nodesToVisit.push(root);
-    
+
     while (!nodesToVisit.empty()) {
         int currentLevelSize = nodesToVisit.size(); // Number of nodes at the current level
         for (int i = 0; i < currentLevelSize; i++) {
             Node* currentNode = nodesToVisit.front();
             nodesToVisit.pop();
-            
+
             // Output the keys of the current node
             cout << "[";
-            for (int j = 0; j < currentNode->keys.size(); j++) {
-                cout << currentNode->keys[j];
-                if (j != currentNode->keys.size() - 1) {cout << " ";}
+            for (int j = 0; j < currentNode->numKeys; j++) {
+                cout << currentNode->keys()[j];
+                if (j != currentNode->numKeys - 1) {cout << " ";}
             }
             cout << "]";
-            
+
             // If it's not a leaf node, enqueue its children
             if (!currentNode->isLeaf) {
-                for (int j = 0; j <= currentNode->keys.size(); j++) {
-                    nodesToVisit.push(static_cast<Node*>(currentNode->pointers[j]));
+                for (int j = 0; j <= currentNode->numKeys; j++) {
+                    nodesToVisit.push(currentNode->children()[j]);
                 }
             }
 
             // Space between nodes of the same level
             if (i != currentLevelSize - 1) {cout << " ";}
         }
-        
+
         // Move to the next level
         cout << endl;
     }
@@ -503,13 +2145,13 @@ void BPlusTree::printValues() {
     // Start from the root and go down to the first leaf node (leftmost)
     Node* currentNode = root;
     while (!currentNode->isLeaf) {
-        currentNode = static_cast<Node*>(currentNode->pointers[0]);
+        currentNode = currentNode->children()[0];
     }
 
     // Traverse the leaf nodes
     while (currentNode) {
-        for (int i = 0; i < currentNode->pointers.size(); i++) {
-            cout << *(static_cast<string*>(currentNode->pointers[i])) << endl;
+        for (int i = 0; i < currentNode->numKeys; i++) {
+            cout << currentNode->values()[i] << endl;
         }
         currentNode = currentNode->next;
     }
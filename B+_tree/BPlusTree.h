@@ -1,47 +1,414 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <utility>
+#include <cstddef>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <cstdint>
+#include "TreeStats.h"
 
 using namespace std;
 
+// A node is a single cache-line-aligned block: this header, then `capacity` keys,
+// then the slots (capacity + 1 child pointers for interior nodes, capacity
+// values stored inline for leaves). Capacity is maxKeys + 1 so a node can hold
+// one key too many until it is split. Interior nodes follow their child
+// pointers with, for each child, the number of keys under it and its aggregate.
 class Node {
 public:
-    vector<int> keys;
-    vector<void*> pointers;  // Holds Node* if internal, string* if leaf
-    Node* parent;
-    Node* next;  // Used for leaves to point to the next leaf
+    int numKeys;
+    int capacity;
     bool isLeaf;
+    int pendingIndex;  // Position in the tree's compaction queue, or -1
+    atomic<int> refCount;  // Parents, trees and snapshots pointing at the node
+    Node* next;  // Used for leaves to point to the next leaf
 
-    Node(bool isLeaf);
+    Node(bool isLeaf, int capacity);
     ~Node();
+
+    int* keys() {return reinterpret_cast<int*>(this + 1);}
+    const int* keys() const {return reinterpret_cast<const int*>(this + 1);}
+    Node** children() {return reinterpret_cast<Node**>(slots());}
+    Node* const* children() const {return reinterpret_cast<Node* const*>(slots());}
+    string* values() {return reinterpret_cast<string*>(slots());}
+    const string* values() const {return reinterpret_cast<const string*>(slots());}
+    uint64_t* counts() {return reinterpret_cast<uint64_t*>(children() + capacity + 1);}
+    const uint64_t* counts() const {return reinterpret_cast<const uint64_t*>(children() + capacity + 1);}
+    long long* aggregates() {return reinterpret_cast<long long*>(counts() + capacity + 1);}
+    const long long* aggregates() const {return reinterpret_cast<const long long*>(counts() + capacity + 1);}
+
+    // Bytes needed for a node of the given kind and capacity
+    static size_t blockSize(bool isLeaf, int capacity);
+
+private:
+    static size_t slotOffset(int capacity);
+    char* slots() {return reinterpret_cast<char*>(this) + slotOffset(capacity);}
+    const char* slots() const {return reinterpret_cast<const char*>(this) + slotOffset(capacity);}
+};
+
+// Hands out fixed-size, cache-line-aligned blocks carved from large chunks.
+// Released blocks are reused; all chunks are freed together by reset() or the destructor.
+class NodeArena {
+private:
+    size_t blockSize;
+    size_t blocksPerChunk;
+    vector<void*> chunks;
+    void* freeList;   // Released blocks, linked through their first word
+    char* chunkNext;  // Unused part of the newest chunk
+    char* chunkEnd;
+
+public:
+    static const size_t kAlignment = 64;
+
+    NodeArena(size_t blockSize);
+    ~NodeArena();
+    void* allocate();
+    void release(void* block);
+    void reset(size_t newBlockSize);
+    // Takes every chunk of other, which must hand out blocks of the same size;
+    // its released and unused blocks join this arena's free list
+    void absorb(NodeArena& other);
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+    // Moving takes every chunk; the source keeps its block size and starts empty
+    NodeArena(NodeArena&& other) noexcept;
+    NodeArena& operator=(NodeArena&& other) noexcept;
+};
+
+// Node memory shared by a tree and its snapshots. A snapshot holds on to the
+// store, so the nodes it reads outlive the tree, and outlive a load() or
+// assignment that moves the tree to a new store. Nodes a snapshot frees are
+// destroyed on its thread and queued here for the tree to return to the arenas.
+struct NodeStore {
+    NodeArena leafArena;
+    NodeArena interiorArena;
+    mutex retiredMutex;
+    vector<pair<void*, bool>> retired;  // Destroyed nodes' blocks, and whether each was a leaf
+    atomic<bool> hasRetired;
+
+    NodeStore(int maxKeys);
+};
+
+// A monoid over a tree's entries: each entry is measured, and the measures of
+// a run of entries are folded in key order with combine, which must be
+// associative with identity as its identity element. Sum, min and max all fit.
+struct TreeAggregate {
+    function<long long(int key, const string& value)> measure;
+    function<long long(long long, long long)> combine;
+    long long identity = 0;
 };
 
 class BPlusTree {
 private:
+    struct PathStep {
+        Node* node;
+        int childIndex;
+    };
+
     Node* root;
     int maxKeys;
+    shared_ptr<NodeStore> store;
+    bool lazyDeletion;
+    int underflowThreshold;
+    bool multimap;
+    vector<Node*> pendingLeaves;  // Under-full leaves left for compact()
+    vector<PathStep> path;  // Scratch path from the root for changes to a leaf
+    TreeAggregate aggregator;  // Maintained only when it has a measure
+    mutable TreeCounters statCounters;
+    mutable unique_ptr<TreeLatency> latencies;  // Only allocated when built with BPLUSTREE_LATENCY=1
+
+    Node* newNode(bool isLeaf);
+    void freeNode(Node* node);
+    void releaseNode(Node* node);
+    void drainRetired();
+    void resetStore();
 
-    void insertIntoInterior(Node* n, int key, Node* leftChild, Node* rightChild);
-    void insertIntoLeaf(Node* leaf, int key, const string& value);
+    // Copy-on-write: a node shared with a snapshot is copied before it changes
+    Node* findLeafForWrite(int key, int delta);
+    Node* writableChild(int depth, int index);
+    Node* unshare(Node* node, int parentDepth, int index);
+
+    // Splits and rebalancing walk back up the path recorded by findLeafForWrite
+    void insertIntoInterior(int depth, int key, Node* leftChild, Node* rightChild);
+    Node* insertKey(int key, int& index);
     void splitLeaf(Node* leaf);
-    void splitInterior(Node* node);
-    Node* findLeaf(int key);
-    void adjustTreeAfterRemoval(Node* node);
-    void mergeNodes(Node* left, Node* right);
+    void splitInterior(int depth);
+    Node* findLeaf(int key) const;
+    void findLeaves(const int* keys, size_t count, Node** leaves, long long* upperFences) const;
+    void insertGroup(Node* leaf, const vector<const pair<int, string>*>& group);
+    void adjustTreeAfterRemoval(Node* node, int depth);
+    void mergeNodes(Node* parent, int leftIndex);
+    void markForCompaction(Node* leaf);
+    void unmarkForCompaction(Node* leaf);
+    void clearCompactionQueue();
+    void countSearch(const Node* node) const;
+
+    // Per-child key counts and aggregates in interior nodes
+    static uint64_t subtreeCount(const Node* node);
+    long long subtreeAggregate(const Node* node) const;
+    long long foldEntries(const Node* leaf, int first, int last) const;
+    long long computeAggregates(Node* node);
+    void summarizeChild(Node* parent, int index);
+    void addToCounts(int64_t delta);
+    void refreshAggregates();
+    size_t countBelow(int key, bool inclusive) const;
+    long long foldRange(const Node* node, int lo, int hi, bool boundedLow, bool boundedHigh) const;
+
+    void bulkLoad(const vector<pair<int, string>>& sortedPairs, double fillFactor);
+    void buildInteriorLevels(vector<Node*>& level, vector<int>& lowestKeys, double fillFactor);
 
-    void destroyTree(Node* node);
-    void copyNodes(Node* toNode, const Node* fromNode);
+    Node* copyNodes(const Node* fromNode, Node*& previousLeaf);
+    void copyParallel(const Node* fromRoot, int threads);
+    // Destroys the nodes under root that nothing else uses, leaving their
+    // blocks to be freed with the store
+    static void destroyTree(Node* root, int threads = 1);
+    static void destroySubtree(Node* node);
 
 public:
     BPlusTree(int maxKeys);
+    // Builds the tree bottom-up from pairs sorted by key, packing each leaf to
+    // fillFactor * maxKeys keys (clamped so no node ends up under-full).
+    BPlusTree(int maxKeys, const vector<pair<int, string>>& sortedPairs, double fillFactor = 1.0);
     ~BPlusTree();
-    bool insert(int key, const string& value);
+    bool insert(int key, const string& value) {return emplace(key, value);}
+    bool insert(int key, string&& value) {return emplace(key, move(value));}
+    // Inserts a value constructed from args; nothing is constructed if the key
+    // is already present, unless the tree is a multimap
+    template <typename... Args>
+    bool emplace(int key, Args&&... args) {
+        LatencyTimer timer(latencies.get(), &TreeLatency::insert);
+        statCounters.inserts.add();
+        int index;
+        Node* leaf = insertKey(key, index);
+        if (!leaf) return false;
+        if (multimap) {
+            PostingList::append(leaf->values()[index], string(forward<Args>(args)...));
+        } else {
+            leaf->values()[index] = string(forward<Args>(args)...);
+        }
+        if (aggregator.measure) {
+            refreshAggregates();
+        }
+        if (leaf->numKeys > maxKeys) {
+            splitLeaf(leaf);
+        }
+        return true;
+    }
     bool remove(int key);
-    string find(int key);
+    // Returns the value, or "<empty>" if the key is missing. The reference is
+    // valid until the tree is next changed.
+    const string& find(int key) const;
+    const string* get(int key) const;  // nullptr if the key is missing
+
+    // Inserts every pair whose key is not already in the tree (the first of
+    // repeated keys wins) and returns how many were inserted. A multimap
+    // appends every pair, in order. The pairs are
+    // sorted and applied a leaf at a time: one descent per leaf, with the
+    // leaf split only after all of its new keys are in.
+    size_t insertBatch(const vector<pair<int, string>>& pairs);
+    // Looks up every key, running several descents side by side and
+    // prefetching the next level. Missing keys give "<empty>", as with find().
+    vector<string> findBatch(const vector<int>& keys);
+
+    // Writes the keys and values to a versioned, checksummed snapshot file.
+    // Leaves left under-full by lazy deletion are written as if compacted.
+    // Returns false if the file cannot be written.
+    bool save(const string& path) const;
+    // Replaces the contents with a snapshot written by save(), rebuilding the
+    // saved leaves bottom-up; the tree takes the snapshot's maxKeys and
+    // multimap mode. Returns false and leaves the tree unchanged if the file
+    // is missing, from another format version, or damaged.
+    bool load(const string& path);
+
+    // Lazy deletion: remove() leaves a leaf under-full, queueing it for
+    // compact() instead of borrowing or merging at once, as long as it keeps
+    // at least underflowThreshold keys (at least 1, so it can be found again by
+    // its first key). Turning it off compacts the whole queue.
+    void setLazyDeletion(bool enabled, int underflowThreshold = 1);
+    // Rebalances up to maxLeaves queued leaves and returns how many are left
+    size_t compact(size_t maxLeaves = 16);
+
+    // Multimap mode: each key holds a posting list instead of a single value.
+    // insert() and insertBatch() append to the key's list and findAll() reads
+    // it back. A list is one entry, so a split never separates equal keys and
+    // order statistics count keys, not values. Everything else that hands out
+    // values (find, iterators, scan, aggregates, save) gives the encoded list,
+    // which PostingList can read. Returns false unless the tree is empty.
+    bool setMultimap(bool enabled);
+    bool isMultimap() const {return multimap;}
+
+    // Read-only view of a posting list, stored as each value's length (a
+    // varint) then its bytes. Appending leaves the values already there in
+    // place, and reading walks them without copying.
+    class PostingList {
+    public:
+        class Iterator {
+        public:
+            string_view operator*() const {return value;}
+            Iterator& operator++();
+            bool operator==(const Iterator& other) const {return position == other.position;}
+            bool operator!=(const Iterator& other) const {return !(*this == other);}
+
+        private:
+            const char* position;  // Start of the current value's length
+            const char* end;
+            string_view value;
+
+            Iterator(const char* position, const char* end);
+            friend class PostingList;
+        };
+
+        PostingList() {}
+        explicit PostingList(string_view encoded) : encoded(encoded) {}
+        Iterator begin() const {return Iterator(encoded.data(), encoded.data() + encoded.size());}
+        Iterator end() const {return Iterator(encoded.data() + encoded.size(), encoded.data() + encoded.size());}
+        bool empty() const {return encoded.empty();}
+        size_t size() const;  // Walks the list
+
+        static void append(string& encoded, string_view value);
+
+    private:
+        string_view encoded;
+    };
+
+    // The values of key in the order they were inserted, or an empty list if
+    // the key is missing. Valid until the tree is next changed.
+    PostingList findAll(int key) const;
+
+    // Empties the tree, destroying the nodes on up to `threads` threads
+    void clear(int threads = 1);
+    // Empties the tree at once and destroys the old nodes on a background
+    // thread. The future is ready once they are gone; it can also be dropped.
+    future<void> clearInBackground(int threads = 1);
+
+    // Operation and restructuring counts since construction or the last
+    // resetCounters(), plus the current node counts. Cheap, and safe to call
+    // from another thread while the tree is in use. Build with
+    // -DBPLUSTREE_STATS=0 to compile the counting out.
+    TreeCounters counters() const {return statCounters;}
+    void resetCounters();  // Zeroes the operation counts; node counts are kept
+    // Insert, find and remove latencies, or nullptr unless built with
+    // -DBPLUSTREE_LATENCY=1. Readable from another thread.
+    const TreeLatency* latency() const {return latencies.get();}
+    // Walks the tree for its height and per-level fill. Unlike counters(),
+    // this must not run alongside changes to the tree.
+    TreeStats stats() const;
+
     void printKeys();
     void printValues();
 
+    // Forward iterator over the leaf chain in key order. Values are returned by
+    // reference; an iterator is invalidated by any insert or remove.
+    class Iterator {
+    public:
+        int key() const {return leaf->keys()[index];}
+        const string& value() const {return leaf->values()[index];}
+        pair<int, const string&> operator*() const {return {key(), value()};}
+        Iterator& operator++();
+        bool operator==(const Iterator& other) const {return leaf == other.leaf && index == other.index;}
+        bool operator!=(const Iterator& other) const {return !(*this == other);}
+
+    private:
+        Node* leaf;  // nullptr once past the last key
+        int index;
+
+        Iterator(Node* leaf, int index);
+        friend class BPlusTree;
+    };
+
+    Iterator begin() const;
+    Iterator end() const;
+    Iterator lowerBound(int key) const;  // First key >= key
+    Iterator upperBound(int key) const;  // First key > key
+
+    // Calls callback(key, value) for every key in [lo, hi], in order
+    template <typename Callback>
+    void scan(int lo, int hi, Callback callback) const {
+        Iterator it = lowerBound(lo);
+        for (Node* leaf = it.leaf; leaf; leaf = leaf->next) {
+            for (int i = (leaf == it.leaf ? it.index : 0); i < leaf->numKeys; i++) {
+                if (leaf->keys()[i] > hi) return;
+                callback(leaf->keys()[i], static_cast<const string&>(leaf->values()[i]));
+            }
+        }
+    }
+
+    // Order statistics, answered from the per-child key counts in O(log n)
+    size_t size() const {return root ? subtreeCount(root) : 0;}
+    size_t rank(int key) const;               // Keys less than key
+    size_t countRange(int lo, int hi) const;  // Keys in [lo, hi]
+    Iterator select(size_t position) const;   // The key at position (from 0), or end()
+
+    // Keeps aggregate folded per child in interior nodes from now on, so any
+    // range can be folded in O(log n); a TreeAggregate without a measure turns
+    // it off. Every change then refolds the children of each node on its path.
+    void setAggregate(const TreeAggregate& aggregate);
+    // The fold of the entries in [lo, hi], or the identity if there are none
+    long long aggregate(int lo, int hi) const;
+
+    // A read-only view of the tree as it was when snapshot() was called. It
+    // shares the tree's nodes, and later changes to the tree copy the nodes on
+    // their path instead of changing them in place, so taking a snapshot is
+    // O(1). A snapshot can be read, copied and released on other threads while
+    // the tree keeps changing; nodes only it still uses are freed when the last
+    // snapshot holding them is released.
+    class Snapshot {
+    public:
+        Snapshot() : root(nullptr) {}
+        Snapshot(const Snapshot& other);
+        Snapshot(Snapshot&& other) noexcept;
+        Snapshot& operator=(Snapshot other) noexcept;
+        ~Snapshot();
+
+        const string& find(int key) const;  // "<empty>" if the key is missing
+        const string* get(int key) const;   // nullptr if the key is missing
+
+        // Calls callback(key, value) for every key in [lo, hi], in order. Leaves
+        // are shared between versions, so their next links belong to the tree
+        // and the scan walks down from its parents instead.
+        template <typename Callback>
+        void scan(int lo, int hi, Callback callback) const {
+            vector<pair<const Node*, int>> path;
+            int index;
+            for (const Node* leaf = seek(lo, path, index); leaf; leaf = nextLeaf(path), index = 0) {
+                for (; index < leaf->numKeys; index++) {
+                    if (leaf->keys()[index] > hi) return;
+                    callback(leaf->keys()[index], static_cast<const string&>(leaf->values()[index]));
+                }
+            }
+        }
+
+    private:
+        shared_ptr<NodeStore> store;
+        Node* root;
+
+        Snapshot(shared_ptr<NodeStore> store, Node* root) : store(move(store)), root(root) {}
+        const Node* seek(int key, vector<pair<const Node*, int>>& path, int& index) const;
+        static const Node* nextLeaf(vector<pair<const Node*, int>>& path);
+        static void release(NodeStore& store, Node* node, vector<pair<void*, bool>>& freed);
+        friend class BPlusTree;
+    };
+
+    Snapshot snapshot() const;
+
     // Copy constructor and assignment operator
     BPlusTree(const BPlusTree& other);
+    // Copies other on up to `threads` threads: the top levels are copied first,
+    // then the subtrees below them are shared out through a TaskPool
+    BPlusTree(const BPlusTree& other, int threads);
     BPlusTree& operator=(const BPlusTree& other);
-};
\ No newline at end of file
+    // Moving hands over the nodes without copying; the source is left empty
+    BPlusTree(BPlusTree&& other) noexcept;
+    BPlusTree& operator=(BPlusTree&& other) noexcept;
+};
+
+#endif
@@ -0,0 +1,493 @@
+#ifndef BASIC_BPLUSTREE_H
+#define BASIC_BPLUSTREE_H
+
+#include <functional>
+#include <utility>
+#include <cstddef>
+
+// Header-only B+ tree with the key type, value type, ordering and fanout fixed at
+// compile time. Values are stored inline in the leaves, so fixed-size records cost
+// nothing beyond their leaf, and every node loop is bounded by a constexpr.
+// Key and Value must be default constructible and movable.
+template <typename Key, typename Value, typename Compare = std::less<Key>, int Fanout = 64>
+class BasicBPlusTree {
+    static_assert(Fanout >= 3, "a node must be able to hold at least 3 keys");
+
+public:
+    static constexpr int maxKeys = Fanout;
+
+private:
+    static constexpr int minLeafKeys = (Fanout + 1) / 2;  // ceiling(maxKeys / 2)
+    static constexpr int minInteriorKeys = Fanout / 2;    // floor(maxKeys / 2)
+
+    // Nodes hold one key more than maxKeys so they can overflow until they are split
+    struct alignas(64) Node {
+        int numKeys;
+        bool isLeaf;
+        Key keys[Fanout + 1];
+
+        Node(bool isLeaf) : numKeys(0), isLeaf(isLeaf) {}
+    };
+
+    struct Leaf : Node {
+        Leaf* next;  // Next leaf in key order
+        Value values[Fanout + 1];
+
+        Leaf() : Node(true), next(nullptr) {}
+    };
+
+    struct Interior : Node {
+        Node* children[Fanout + 2];
+
+        Interior() : Node(false) {}
+    };
+
+    Node* root;
+    size_t numEntries;
+    Compare compare;
+
+public:
+    BasicBPlusTree() : root(nullptr), numEntries(0), compare() {}
+    ~BasicBPlusTree() {destroyTree(root);}
+
+    BasicBPlusTree(const BasicBPlusTree& other) : root(nullptr), numEntries(other.numEntries), compare(other.compare) {
+        Leaf* previousLeaf = nullptr;
+        if (other.root) {root = copyNodes(other.root, previousLeaf);}
+    }
+
+    BasicBPlusTree(BasicBPlusTree&& other) noexcept : root(other.root), numEntries(other.numEntries), compare(other.compare) {
+        other.root = nullptr;
+        other.numEntries = 0;
+    }
+
+    BasicBPlusTree& operator=(BasicBPlusTree other) {
+        std::swap(root, other.root);
+        std::swap(numEntries, other.numEntries);
+        std::swap(compare, other.compare);
+        return *this;
+    }
+
+    size_t size() const {return numEntries;}
+    bool empty() const {return numEntries == 0;}
+
+    void clear() {
+        destroyTree(root);
+        root = nullptr;
+        numEntries = 0;
+    }
+
+    // Returns false if the key already exists
+    bool insert(const Key& key, const Value& value) {
+        if (!root) {root = new Leaf();}
+
+        bool inserted = false;
+        Key splitKey;
+        Node* newSibling = insertInto(root, key, value, splitKey, inserted);
+
+        // Grow the tree if the root split
+        if (newSibling) {
+            Interior* newRoot = new Interior();
+            newRoot->keys[0] = std::move(splitKey);
+            newRoot->children[0] = root;
+            newRoot->children[1] = newSibling;
+            newRoot->numKeys = 1;
+            root = newRoot;
+        }
+
+        if (inserted) {numEntries++;}
+        return inserted;
+    }
+
+    // Returns false if the key was not found
+    bool remove(const Key& key) {
+        if (!root || !removeFrom(root, key)) return false;
+        numEntries--;
+
+        // Shrink the tree once the root runs out of keys
+        if (root->numKeys == 0) {
+            Node* oldRoot = root;
+            root = root->isLeaf ? nullptr : static_cast<Interior*>(root)->children[0];
+            freeNode(oldRoot);
+        }
+        return true;
+    }
+
+    // Returns nullptr if the key was not found
+    const Value* find(const Key& key) const {
+        if (!root) return nullptr;
+        const Leaf* leaf = findLeaf(key);
+        int i = lowerBound(leaf->keys, leaf->numKeys, key);
+        if (i < leaf->numKeys && !compare(key, leaf->keys[i])) {
+            return &leaf->values[i];
+        }
+        return nullptr;
+    }
+
+    // Forward iterator over the leaves in key order; invalidated by insert and remove
+    class Iterator {
+    public:
+        const Key& key() const {return leaf->keys[index];}
+        const Value& value() const {return leaf->values[index];}
+        std::pair<const Key&, const Value&> operator*() const {return {key(), value()};}
+        Iterator& operator++() {
+            *this = Iterator(leaf, index + 1);
+            return *this;
+        }
+        bool operator==(const Iterator& other) const {return leaf == other.leaf && index == other.index;}
+        bool operator!=(const Iterator& other) const {return !(*this == other);}
+
+    private:
+        const Leaf* leaf;  // nullptr once past the last key
+        int index;
+
+        Iterator(const Leaf* leaf, int index) : leaf(leaf), index(index) {
+            // Step over the end of a leaf onto the first key of the next one
+            while (this->leaf && this->index >= this->leaf->numKeys) {
+                this->leaf = this->leaf->next;
+                this->index = 0;
+            }
+        }
+        friend class BasicBPlusTree;
+    };
+
+    Iterator begin() const {
+        if (!root) return end();
+        const Node* node = root;
+        while (!node->isLeaf) {
+            node = static_cast<const Interior*>(node)->children[0];
+        }
+        return Iterator(static_cast<const Leaf*>(node), 0);
+    }
+
+    Iterator end() const {return Iterator(nullptr, 0);}
+
+    // First key >= key
+    Iterator lowerBound(const Key& key) const {
+        if (!root) return end();
+        const Leaf* leaf = findLeaf(key);
+        return Iterator(leaf, lowerBound(leaf->keys, leaf->numKeys, key));
+    }
+
+    // First key > key
+    Iterator upperBound(const Key& key) const {
+        if (!root) return end();
+        const Leaf* leaf = findLeaf(key);
+        return Iterator(leaf, upperBound(leaf->keys, leaf->numKeys, key));
+    }
+
+    // Calls callback(key, value) for every key in [lo, hi], in order
+    template <typename Callback>
+    void scan(const Key& lo, const Key& hi, Callback callback) const {
+        Iterator it = lowerBound(lo);
+        for (const Leaf* leaf = it.leaf; leaf; leaf = leaf->next) {
+            for (int i = (leaf == it.leaf ? it.index : 0); i < leaf->numKeys; i++) {
+                if (compare(hi, leaf->keys[i])) return;
+                callback(leaf->keys[i], leaf->values[i]);
+            }
+        }
+    }
+
+private:
+    // Branchless binary search: index of the first key that is not less than key.
+    // The trip count depends only on n, so it unrolls well for a constexpr Fanout.
+    int lowerBound(const Key* keys, int n, const Key& key) const {
+        const Key* base = keys;
+        while (n > 1) {
+            int half = n / 2;
+            base = compare(base[half], key) ? base + half : base;
+            n -= half;
+        }
+        return (base - keys) + (n == 1 && compare(*base, key));
+    }
+
+    // Index of the first key greater than key
+    int upperBound(const Key* keys, int n, const Key& key) const {
+        const Key* base = keys;
+        while (n > 1) {
+            int half = n / 2;
+            base = !compare(key, base[half]) ? base + half : base;
+            n -= half;
+        }
+        return (base - keys) + (n == 1 && !compare(key, *base));
+    }
+
+    const Leaf* findLeaf(const Key& key) const {
+        const Node* node = root;
+        while (!node->isLeaf) {
+            const Interior* interior = static_cast<const Interior*>(node);
+            node = interior->children[upperBound(interior->keys, interior->numKeys, key)];
+        }
+        return static_cast<const Leaf*>(node);
+    }
+
+    // Inserts into the subtree under node. If node had to split, returns its new
+    // right sibling and sets splitKey to the key that separates them.
+    Node* insertInto(Node* node, const Key& key, const Value& value, Key& splitKey, bool& inserted) {
+        if (node->isLeaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            int i = lowerBound(leaf->keys, leaf->numKeys, key);
+            if (i < leaf->numKeys && !compare(key, leaf->keys[i])) return nullptr;
+
+            // Shift everything from i one slot right and place the key at i
+            for (int j = leaf->numKeys; j > i; j--) {
+                leaf->keys[j] = std::move(leaf->keys[j - 1]);
+                leaf->values[j] = std::move(leaf->values[j - 1]);
+            }
+            leaf->keys[i] = key;
+            leaf->values[i] = value;
+            leaf->numKeys++;
+            inserted = true;
+
+            if (leaf->numKeys > Fanout) return splitLeaf(leaf, splitKey);
+            return nullptr;
+        }
+
+        Interior* interior = static_cast<Interior*>(node);
+        int i = upperBound(interior->keys, interior->numKeys, key);
+        Key childSplitKey;
+        Node* newChild = insertInto(interior->children[i], key, value, childSplitKey, inserted);
+        if (!newChild) return nullptr;
+
+        // Insert the child's separator and its new sibling to the right of it
+        for (int j = interior->numKeys; j > i; j--) {
+            interior->keys[j] = std::move(interior->keys[j - 1]);
+            interior->children[j + 1] = interior->children[j];
+        }
+        interior->keys[i] = std::move(childSplitKey);
+        interior->children[i + 1] = newChild;
+        interior->numKeys++;
+
+        if (interior->numKeys > Fanout) return splitInterior(interior, splitKey);
+        return nullptr;
+    }
+
+    Leaf* splitLeaf(Leaf* leaf, Key& splitKey) {
+        Leaf* newLeaf = new Leaf();
+        int leftSize = (Fanout + 2) / 2;  // ceiling((maxKeys + 1) / 2)
+
+        for (int i = leftSize; i < leaf->numKeys; i++) {
+            newLeaf->keys[i - leftSize] = std::move(leaf->keys[i]);
+            newLeaf->values[i - leftSize] = std::move(leaf->values[i]);
+        }
+        newLeaf->numKeys = leaf->numKeys - leftSize;
+        leaf->numKeys = leftSize;
+
+        newLeaf->next = leaf->next;
+        leaf->next = newLeaf;
+        splitKey = newLeaf->keys[0];
+        return newLeaf;
+    }
+
+    Interior* splitInterior(Interior* interior, Key& splitKey) {
+        Interior* newInterior = new Interior();
+        int middleIndex = (Fanout + 1) / 2;  // Leaves floor(maxKeys / 2) keys on both sides
+
+        for (int i = middleIndex + 1; i < interior->numKeys; i++) {
+            newInterior->keys[i - middleIndex - 1] = std::move(interior->keys[i]);
+        }
+        for (int i = middleIndex + 1; i <= interior->numKeys; i++) {
+            newInterior->children[i - middleIndex - 1] = interior->children[i];
+        }
+        newInterior->numKeys = interior->numKeys - middleIndex - 1;
+        interior->numKeys = middleIndex;
+
+        splitKey = std::move(interior->keys[middleIndex]);
+        return newInterior;
+    }
+
+    // Removes key from the subtree under node, rebalancing any child it leaves
+    // under-full. Returns false if the key was not found.
+    bool removeFrom(Node* node, const Key& key) {
+        if (node->isLeaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            int i = lowerBound(leaf->keys, leaf->numKeys, key);
+            if (i == leaf->numKeys || compare(key, leaf->keys[i])) return false;
+
+            for (int j = i + 1; j < leaf->numKeys; j++) {
+                leaf->keys[j - 1] = std::move(leaf->keys[j]);
+                leaf->values[j - 1] = std::move(leaf->values[j]);
+            }
+            leaf->numKeys--;
+            leaf->values[leaf->numKeys] = Value();
+            return true;
+        }
+
+        Interior* interior = static_cast<Interior*>(node);
+        int i = upperBound(interior->keys, interior->numKeys, key);
+        if (!removeFrom(interior->children[i], key)) return false;
+
+        Node* child = interior->children[i];
+        if (child->numKeys < (child->isLeaf ? minLeafKeys : minInteriorKeys)) {
+            rebalanceChild(interior, i);
+        }
+        return true;
+    }
+
+    // Refills the under-full child i of parent by borrowing from or merging with a sibling
+    void rebalanceChild(Interior* parent, int i) {
+        Node* node = parent->children[i];
+        Node* left = i > 0 ? parent->children[i - 1] : nullptr;
+        Node* right = i < parent->numKeys ? parent->children[i + 1] : nullptr;
+        int minKeys = node->isLeaf ? minLeafKeys : minInteriorKeys;
+
+        if (left && left->numKeys > minKeys) {
+            borrowFromLeft(parent, i);
+        } else if (right && right->numKeys > minKeys) {
+            borrowFromRight(parent, i);
+        } else if (left) {
+            mergeChildren(parent, i - 1);
+        } else if (right) {
+            mergeChildren(parent, i);
+        }
+    }
+
+    void borrowFromLeft(Interior* parent, int i) {
+        Node* node = parent->children[i];
+        Node* left = parent->children[i - 1];
+
+        for (int j = node->numKeys; j > 0; j--) {
+            node->keys[j] = std::move(node->keys[j - 1]);
+        }
+
+        if (node->isLeaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            Leaf* leftLeaf = static_cast<Leaf*>(left);
+            for (int j = leaf->numKeys; j > 0; j--) {
+                leaf->values[j] = std::move(leaf->values[j - 1]);
+            }
+            leaf->keys[0] = std::move(leftLeaf->keys[leftLeaf->numKeys - 1]);
+            leaf->values[0] = std::move(leftLeaf->values[leftLeaf->numKeys - 1]);
+            parent->keys[i - 1] = leaf->keys[0];
+        } else {
+            Interior* interior = static_cast<Interior*>(node);
+            Interior* leftInterior = static_cast<Interior*>(left);
+            for (int j = interior->numKeys + 1; j > 0; j--) {
+                interior->children[j] = interior->children[j - 1];
+            }
+            interior->keys[0] = std::move(parent->keys[i - 1]);
+            interior->children[0] = leftInterior->children[leftInterior->numKeys];
+            parent->keys[i - 1] = std::move(leftInterior->keys[leftInterior->numKeys - 1]);
+        }
+
+        node->numKeys++;
+        left->numKeys--;
+    }
+
+    void borrowFromRight(Interior* parent, int i) {
+        Node* node = parent->children[i];
+        Node* right = parent->children[i + 1];
+
+        if (node->isLeaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            Leaf* rightLeaf = static_cast<Leaf*>(right);
+            leaf->keys[leaf->numKeys] = std::move(rightLeaf->keys[0]);
+            leaf->values[leaf->numKeys] = std::move(rightLeaf->values[0]);
+            for (int j = 1; j < rightLeaf->numKeys; j++) {
+                rightLeaf->keys[j - 1] = std::move(rightLeaf->keys[j]);
+                rightLeaf->values[j - 1] = std::move(rightLeaf->values[j]);
+            }
+            parent->keys[i] = rightLeaf->keys[0];
+        } else {
+            Interior* interior = static_cast<Interior*>(node);
+            Interior* rightInterior = static_cast<Interior*>(right);
+            interior->keys[interior->numKeys] = std::move(parent->keys[i]);
+            interior->children[interior->numKeys + 1] = rightInterior->children[0];
+            parent->keys[i] = std::move(rightInterior->keys[0]);
+            for (int j = 1; j < rightInterior->numKeys; j++) {
+                rightInterior->keys[j - 1] = std::move(rightInterior->keys[j]);
+            }
+            for (int j = 1; j <= rightInterior->numKeys; j++) {
+                rightInterior->children[j - 1] = rightInterior->children[j];
+            }
+        }
+
+        node->numKeys++;
+        right->numKeys--;
+    }
+
+    // Moves everything in child i + 1 into child i and drops the separator between them
+    void mergeChildren(Interior* parent, int i) {
+        Node* left = parent->children[i];
+        Node* right = parent->children[i + 1];
+
+        if (left->isLeaf) {
+            Leaf* leftLeaf = static_cast<Leaf*>(left);
+            Leaf* rightLeaf = static_cast<Leaf*>(right);
+            for (int j = 0; j < rightLeaf->numKeys; j++) {
+                leftLeaf->keys[leftLeaf->numKeys + j] = std::move(rightLeaf->keys[j]);
+                leftLeaf->values[leftLeaf->numKeys + j] = std::move(rightLeaf->values[j]);
+            }
+            leftLeaf->numKeys += rightLeaf->numKeys;
+            leftLeaf->next = rightLeaf->next;
+        } else {
+            Interior* leftInterior = static_cast<Interior*>(left);
+            Interior* rightInterior = static_cast<Interior*>(right);
+            leftInterior->keys[leftInterior->numKeys] = std::move(parent->keys[i]);
+            for (int j = 0; j < rightInterior->numKeys; j++) {
+                leftInterior->keys[leftInterior->numKeys + 1 + j] = std::move(rightInterior->keys[j]);
+            }
+            for (int j = 0; j <= rightInterior->numKeys; j++) {
+                leftInterior->children[leftInterior->numKeys + 1 + j] = rightInterior->children[j];
+            }
+            leftInterior->numKeys += rightInterior->numKeys + 1;
+        }
+
+        for (int j = i + 1; j < parent->numKeys; j++) {
+            parent->keys[j - 1] = std::move(parent->keys[j]);
+        }
+        for (int j = i + 2; j <= parent->numKeys; j++) {
+            parent->children[j - 1] = parent->children[j];
+        }
+        parent->numKeys--;
+
+        freeNode(right);
+    }
+
+    static void freeNode(Node* node) {
+        if (node->isLeaf) {
+            delete static_cast<Leaf*>(node);
+        } else {
+            delete static_cast<Interior*>(node);
+        }
+    }
+
+    static void destroyTree(Node* node) {
+        if (!node) return;
+        if (!node->isLeaf) {
+            Interior* interior = static_cast<Interior*>(node);
+            for (int i = 0; i <= interior->numKeys; i++) {
+                destroyTree(interior->children[i]);
+            }
+        }
+        freeNode(node);
+    }
+
+    // Deep-copies the subtree under node, relinking the leaves in order
+    static Node* copyNodes(const Node* node, Leaf*& previousLeaf) {
+        if (node->isLeaf) {
+            const Leaf* leaf = static_cast<const Leaf*>(node);
+            Leaf* copy = new Leaf();
+            for (int i = 0; i < leaf->numKeys; i++) {
+                copy->keys[i] = leaf->keys[i];
+                copy->values[i] = leaf->values[i];
+            }
+            copy->numKeys = leaf->numKeys;
+            if (previousLeaf) {previousLeaf->next = copy;}
+            previousLeaf = copy;
+            return copy;
+        }
+
+        const Interior* interior = static_cast<const Interior*>(node);
+        Interior* copy = new Interior();
+        for (int i = 0; i < interior->numKeys; i++) {
+            copy->keys[i] = interior->keys[i];
+        }
+        for (int i = 0; i <= interior->numKeys; i++) {
+            copy->children[i] = copyNodes(interior->children[i], previousLeaf);
+        }
+        copy->numKeys = interior->numKeys;
+        return copy;
+    }
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include "BufferPool.h"
+
+using namespace std;
+
+// Page handle initialization
+PageHandle::PageHandle() : pool(nullptr), frame(0) {}
+
+PageHandle::PageHandle(BufferPool* pool, size_t frame) : pool(pool), frame(frame) {}
+
+// Page handle deletion
+PageHandle::~PageHandle() {
+    release();
+}
+
+PageHandle::PageHandle(PageHandle&& other) : pool(other.pool), frame(other.frame) {
+    other.pool = nullptr;
+}
+
+PageHandle& PageHandle::operator=(PageHandle&& other) {
+    if (this == &other) return *this;
+    release();
+    pool = other.pool;
+    frame = other.frame;
+    other.pool = nullptr;
+    return *this;
+}
+
+void PageHandle::release() {
+    if (pool) {pool->unpin(frame);}
+    pool = nullptr;
+}
+
+char* PageHandle::data() const {
+    return pool->frames[frame].data;
+}
+
+uint32_t PageHandle::pageId() const {
+    return pool->frames[frame].pageId;
+}
+
+void PageHandle::markDirty() {
+    pool->markDirty(pool->frames[frame]);
+}
+
+
+// Buffer pool initialization
+BufferPool::BufferPool(int fd, size_t numFrames) : fd(fd), frames(numFrames), clockHand(0), numDirty(0) {
+    // One page-aligned block backs every frame
+    memory = static_cast<char*>(::operator new(numFrames * kPageSize, align_val_t(kPageSize)));
+    for (size_t i = 0; i < numFrames; i++) {
+        frames[i] = {0, 0, false, false, false, memory + i * kPageSize};
+    }
+}
+
+// Buffer pool deletion
+BufferPool::~BufferPool() {
+    ::operator delete(memory, align_val_t(kPageSize));
+}
+
+PageHandle BufferPool::fetch(uint32_t pageId) {
+    auto cached = pageTable.find(pageId);
+    if (cached != pageTable.end()) {
+        Frame& frame = frames[cached->second];
+        frame.pinCount++;
+        frame.referenced = true;
+        return PageHandle(this, cached->second);
+    }
+
+    size_t index = claimFrame(pageId);
+    Frame& frame = frames[index];
+    ssize_t bytesRead = pread(fd, frame.data, kPageSize, (off_t)pageId * kPageSize);
+    if (bytesRead < 0) {
+        frame.inUse = false;
+        frame.pinCount = 0;
+        pageTable.erase(pageId);
+        throw runtime_error("BufferPool: failed to read page " + to_string(pageId));
+    }
+
+    // Bytes past the end of the file read as zeros
+    memset(frame.data + bytesRead, 0, kPageSize - bytesRead);
+    return PageHandle(this, index);
+}
+
+PageHandle BufferPool::create(uint32_t pageId) {
+    auto cached = pageTable.find(pageId);
+    size_t index;
+    if (cached != pageTable.end()) {
+        index = cached->second;
+        frames[index].pinCount++;
+        frames[index].referenced = true;
+    } else {
+        index = claimFrame(pageId);
+    }
+
+    memset(frames[index].data, 0, kPageSize);
+    markDirty(frames[index]);
+    return PageHandle(this, index);
+}
+
+void BufferPool::flushAll() {
+    for (Frame& frame : frames) {
+        if (frame.inUse && frame.dirty) {
+            writeFrame(frame);
+        }
+    }
+}
+
+size_t BufferPool::dirtyCount() const {
+    return numDirty;
+}
+
+size_t BufferPool::capacity() const {
+    return frames.size();
+}
+
+// Picks a clean, unpinned frame for pageId
+size_t BufferPool::claimFrame(uint32_t pageId) {
+    size_t index = findVictim();
+    Frame& frame = frames[index];
+    if (frame.inUse) {
+        pageTable.erase(frame.pageId);
+    }
+
+    frame.pageId = pageId;
+    frame.pinCount = 1;
+    frame.dirty = false;
+    frame.referenced = true;
+    frame.inUse = true;
+    pageTable[pageId] = index;
+    return index;
+}
+
+// CLOCK: sweep the frames, clearing reference bits, until a clean, unpinned
+// frame that has not been used since the last sweep comes up
+size_t BufferPool::findVictim() {
+    for (size_t step = 0; step < 2 * frames.size(); step++) {
+        size_t index = clockHand;
+        clockHand = (clockHand + 1) % frames.size();
+
+        Frame& frame = frames[index];
+        if (!frame.inUse) return index;
+        if (frame.pinCount > 0 || frame.dirty) continue;
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        return index;
+    }
+    throw runtime_error("BufferPool: every frame is pinned or dirty");
+}
+
+void BufferPool::writeFrame(Frame& frame) {
+    ssize_t written = pwrite(fd, frame.data, kPageSize, (off_t)frame.pageId * kPageSize);
+    if (written != (ssize_t)kPageSize) {
+        throw runtime_error("BufferPool: failed to write page " + to_string(frame.pageId));
+    }
+    frame.dirty = false;
+    numDirty--;
+}
+
+void BufferPool::markDirty(Frame& frame) {
+    if (!frame.dirty) {
+        frame.dirty = true;
+        numDirty++;
+    }
+}
+
+void BufferPool::unpin(size_t frame) {
+    frames[frame].pinCount--;
+}
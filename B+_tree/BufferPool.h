@@ -0,0 +1,91 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+const size_t kPageSize = 4096;
+
+class BufferPool;
+
+// A pinned page in the buffer pool. The page stays in memory until the handle
+// is destroyed; call markDirty() after changing its bytes.
+class PageHandle {
+public:
+    PageHandle();
+    ~PageHandle();
+    PageHandle(PageHandle&& other);
+    PageHandle& operator=(PageHandle&& other);
+
+    char* data() const;
+    uint32_t pageId() const;
+    void markDirty();
+
+    PageHandle(const PageHandle&) = delete;
+    PageHandle& operator=(const PageHandle&) = delete;
+
+private:
+    BufferPool* pool;
+    size_t frame;
+
+    PageHandle(BufferPool* pool, size_t frame);
+    void release();
+    friend class BufferPool;
+};
+
+// Caches fixed-size pages of a file in a fixed number of frames, evicting with
+// the CLOCK algorithm. Only clean pages are evicted: dirty pages stay in memory
+// until flushAll(), so the file changes only when the owner chooses to write
+// it (after logging the page images). I/O errors are reported by throwing
+// runtime_error.
+class BufferPool {
+public:
+    BufferPool(int fd, size_t numFrames);
+    ~BufferPool();
+
+    PageHandle fetch(uint32_t pageId);   // Reads the page if it is not cached
+    PageHandle create(uint32_t pageId);  // Zero-filled page that is not read from the file
+    void flushAll();                     // Writes back every dirty page
+    size_t dirtyCount() const;
+    size_t capacity() const;
+
+    template <typename Callback>
+    void forEachDirty(Callback callback) const {
+        for (const Frame& frame : frames) {
+            if (frame.inUse && frame.dirty) {callback(frame.pageId, (const char*)frame.data);}
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+private:
+    struct Frame {
+        uint32_t pageId;
+        int pinCount;
+        bool dirty;
+        bool referenced;  // Second chance for the clock hand
+        bool inUse;
+        char* data;
+    };
+
+    int fd;
+    char* memory;
+    vector<Frame> frames;
+    unordered_map<uint32_t, size_t> pageTable;  // Page ID -> frame
+    size_t clockHand;
+    size_t numDirty;
+
+    size_t findVictim();
+    size_t claimFrame(uint32_t pageId);
+    void writeFrame(Frame& frame);
+    void markDirty(Frame& frame);
+    void unpin(size_t frame);
+    friend class PageHandle;
+};
+
+#endif
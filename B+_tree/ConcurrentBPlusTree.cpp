@@ -0,0 +1,558 @@
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <new>
+#include "ConcurrentBPlusTree.h"
+#include "NodeSearch.h"
+
+using namespace std;
+
+namespace {
+
+// Every thread claims one slot index, used by all reclaimers
+atomic<bool> slotTaken[EpochReclaimer::kMaxThreads];
+
+struct ThreadSlot {
+    int index;
+
+    ThreadSlot() : index(-1) {
+        while (index < 0) {
+            for (int i = 0; i < EpochReclaimer::kMaxThreads && index < 0; i++) {
+                bool expected = false;
+                if (slotTaken[i].compare_exchange_strong(expected, true)) {index = i;}
+            }
+            if (index < 0) {this_thread::yield();}
+        }
+    }
+
+    ~ThreadSlot() {
+        slotTaken[index].store(false);
+    }
+};
+
+int threadSlot() {
+    thread_local ThreadSlot slot;
+    return slot.index;
+}
+
+// Keeps the calling thread inside an epoch for the rest of the scope
+class EpochGuard {
+public:
+    EpochGuard(EpochReclaimer& reclaimer) : reclaimer(reclaimer) {reclaimer.enter();}
+    ~EpochGuard() {reclaimer.exit();}
+
+private:
+    EpochReclaimer& reclaimer;
+};
+
+const uint64_t kObsoleteBit = 0b01;
+const uint64_t kLockedBit = 0b10;
+const size_t kCollectInterval = 64;
+
+}
+
+
+// Reclaimer initialization
+EpochReclaimer::EpochReclaimer() : globalEpoch(1) {
+    for (Slot& slot : slots) {
+        slot.epoch.store(0);
+    }
+}
+
+// Reclaimer deletion, once no thread is using it
+EpochReclaimer::~EpochReclaimer() {
+    for (Slot& slot : slots) {
+        for (Retired& item : slot.retired) {
+            item.deleter(item.pointer);
+        }
+    }
+}
+
+void EpochReclaimer::enter() {
+    slots[threadSlot()].epoch.store(globalEpoch.load());
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void EpochReclaimer::exit() {
+    slots[threadSlot()].epoch.store(0, memory_order_release);
+}
+
+// Items stay on the retiring thread's list; a thread that later takes over
+// the slot inherits whatever is left on it.
+void EpochReclaimer::retire(void* pointer, void (*deleter)(void*)) {
+    vector<Retired>& retired = slots[threadSlot()].retired;
+    retired.push_back({pointer, deleter, globalEpoch.load()});
+    if (retired.size() % kCollectInterval == 0) {
+        collect(retired);
+    }
+}
+
+// Frees the items on the list retired before the oldest epoch a thread is still in
+void EpochReclaimer::collect(vector<Retired>& retired) {
+    globalEpoch.fetch_add(1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint64_t oldestActive = globalEpoch.load();
+    for (Slot& slot : slots) {
+        uint64_t epoch = slot.epoch.load();
+        if (epoch != 0 && epoch < oldestActive) {oldestActive = epoch;}
+    }
+
+    size_t kept = 0;
+    for (Retired& item : retired) {
+        if (item.epoch < oldestActive) {
+            item.deleter(item.pointer);
+        } else {
+            retired[kept++] = item;
+        }
+    }
+    retired.resize(kept);
+}
+
+
+// Returns the node's version, or asks for a restart if it is locked or obsolete
+uint64_t ConcurrentBPlusTree::Node::readLockOrRestart(bool& needRestart) const {
+    uint64_t currentVersion = version.load(memory_order_acquire);
+    if (currentVersion & (kLockedBit | kObsoleteBit)) {
+        this_thread::yield();
+        needRestart = true;
+    }
+    return currentVersion;
+}
+
+// Asks for a restart if the node changed since startVersion was read
+void ConcurrentBPlusTree::Node::readUnlockOrRestart(uint64_t startVersion, bool& needRestart) const {
+    atomic_thread_fence(memory_order_acquire);
+    if (startVersion != version.load(memory_order_relaxed)) {
+        needRestart = true;
+    }
+}
+
+// Locks the node only if it has not changed since currentVersion was read
+void ConcurrentBPlusTree::Node::upgradeToWriteLockOrRestart(uint64_t& currentVersion, bool& needRestart) {
+    if (version.compare_exchange_strong(currentVersion, currentVersion + kLockedBit, memory_order_acquire)) {
+        currentVersion += kLockedBit;
+        // Readers must see the lock before any of the writes that follow
+        atomic_thread_fence(memory_order_release);
+    } else {
+        needRestart = true;
+    }
+}
+
+// Clears the lock bit and bumps the version counter
+void ConcurrentBPlusTree::Node::writeUnlock() {
+    version.fetch_add(kLockedBit, memory_order_release);
+}
+
+void ConcurrentBPlusTree::Node::writeUnlockObsolete() {
+    version.fetch_add(kLockedBit | kObsoleteBit, memory_order_release);
+}
+
+
+// B+ tree initialization
+ConcurrentBPlusTree::ConcurrentBPlusTree(int maxKeys) :
+    root(nullptr),
+    maxKeys(max(3, maxKeys)),        // Refilling needs nodes that keep at least one key
+    minKeys((max(3, maxKeys) - 1) / 2) // Two minimal nodes plus a separator still fit in one
+{
+    root.store(newNode(true));
+}
+
+// B+ tree destructor
+ConcurrentBPlusTree::~ConcurrentBPlusTree() {
+    destroyTree(root.load());
+}
+
+void ConcurrentBPlusTree::destroyTree(Node* node) {
+    for (int i = 0; i < node->count(); i++) {
+        if (node->isLeaf) {
+            freeValue(const_cast<string*>(node->value(i)));
+        }
+    }
+    if (!node->isLeaf) {
+        for (int i = 0; i <= node->count(); i++) {
+            destroyTree(node->child(i));
+        }
+    }
+    freeNode(node);
+}
+
+ConcurrentBPlusTree::Node* ConcurrentBPlusTree::newNode(bool isLeaf) {
+    // The header, keys and slots share one allocation
+    size_t keyBytes = (maxKeys * sizeof(int) + 7) / 8 * 8;
+    size_t slotBytes = (maxKeys + 1) * sizeof(atomic<void*>);
+    char* block = static_cast<char*>(::operator new(sizeof(Node) + keyBytes + slotBytes));
+
+    Node* node = new (block) Node();
+    node->version.store(0);
+    node->numKeys.store(0);
+    node->isLeaf = isLeaf;
+    node->keys = reinterpret_cast<int*>(block + sizeof(Node));
+    node->slots = reinterpret_cast<atomic<void*>*>(block + sizeof(Node) + keyBytes);
+    for (int i = 0; i <= maxKeys; i++) {
+        new (&node->slots[i]) atomic<void*>(nullptr);
+    }
+    return node;
+}
+
+void ConcurrentBPlusTree::freeNode(void* node) {
+    ::operator delete(node);
+}
+
+void ConcurrentBPlusTree::freeValue(void* value) {
+    delete static_cast<string*>(value);
+}
+
+int ConcurrentBPlusTree::childIndex(const Node* node, int key) const {
+    return NodeSearch::upperBound(node->keys, node->count(), key);
+}
+
+string ConcurrentBPlusTree::find(int key) const {
+    EpochGuard guard(reclaimer);
+
+    while (true) {
+        bool needRestart = false;
+        Node* node = root.load();
+        uint64_t version = node->readLockOrRestart(needRestart);
+        if (needRestart || node != root.load()) continue;
+
+        // Lock coupling: read the child's version before validating the node it came from
+        while (!node->isLeaf) {
+            Node* child = node->child(childIndex(node, key));
+            if (!child) {needRestart = true; break;}
+            uint64_t childVersion = child->readLockOrRestart(needRestart);
+            if (needRestart) break;
+            node->readUnlockOrRestart(version, needRestart);
+            if (needRestart) break;
+
+            node = child;
+            version = childVersion;
+        }
+        if (needRestart) continue;
+
+        int numKeys = node->count();
+        int i = NodeSearch::lowerBound(node->keys, numKeys, key);
+        const string* value = (i < numKeys && node->keys[i] == key) ? node->value(i) : nullptr;
+        node->readUnlockOrRestart(version, needRestart);
+        if (needRestart) continue;
+
+        // Values are never modified in place, and this thread's epoch keeps them alive
+        return value ? *value : "<empty>";
+    }
+}
+
+bool ConcurrentBPlusTree::insert(int key, const string& value) {
+    EpochGuard guard(reclaimer);
+
+    while (true) {
+        bool needRestart = false;
+        Node* parent = nullptr;
+        uint64_t parentVersion = 0;
+        Node* node = root.load();
+        uint64_t version = node->readLockOrRestart(needRestart);
+        if (needRestart || node != root.load()) continue;
+
+        while (true) {
+            // Split full nodes on the way down so every parent has room for a new separator
+            if (node->count() == maxKeys) {
+                if (parent) {
+                    parent->upgradeToWriteLockOrRestart(parentVersion, needRestart);
+                    if (needRestart) break;
+                }
+                node->upgradeToWriteLockOrRestart(version, needRestart);
+                if (needRestart) {
+                    if (parent) {parent->writeUnlock();}
+                    break;
+                }
+
+                splitChild(parent, node);
+                node->writeUnlock();
+                if (parent) {parent->writeUnlock();}
+                needRestart = true;
+                break;
+            }
+            if (node->isLeaf) break;
+
+            Node* child = node->child(childIndex(node, key));
+            if (!child) {needRestart = true; break;}
+            uint64_t childVersion = child->readLockOrRestart(needRestart);
+            if (needRestart) break;
+            node->readUnlockOrRestart(version, needRestart);
+            if (needRestart) break;
+
+            parent = node;
+            parentVersion = version;
+            node = child;
+            version = childVersion;
+        }
+        if (needRestart) continue;
+
+        // The leaf has room, so only the leaf itself needs to be locked
+        node->upgradeToWriteLockOrRestart(version, needRestart);
+        if (needRestart) continue;
+
+        int numKeys = node->count();
+        int i = NodeSearch::lowerBound(node->keys, numKeys, key);
+        if (i < numKeys && node->keys[i] == key) {
+            node->writeUnlock();
+            return false;
+        }
+
+        for (int j = numKeys; j > i; j--) {
+            node->keys[j] = node->keys[j - 1];
+            node->setSlot(j, node->slots[j - 1].load(memory_order_relaxed));
+        }
+        node->keys[i] = key;
+        node->setSlot(i, new string(value));
+        node->numKeys.store(numKeys + 1, memory_order_relaxed);
+
+        node->writeUnlock();
+        return true;
+    }
+}
+
+bool ConcurrentBPlusTree::remove(int key) {
+    EpochGuard guard(reclaimer);
+
+    while (true) {
+        bool needRestart = false;
+        Node* parent = nullptr;
+        uint64_t parentVersion = 0;
+        int indexInParent = 0;
+        Node* node = root.load();
+        uint64_t version = node->readLockOrRestart(needRestart);
+        if (needRestart || node != root.load()) continue;
+
+        while (true) {
+            // Refill minimal nodes on the way down so removing a key never leaves one under-full
+            if (parent && node->count() <= minKeys) {
+                parent->upgradeToWriteLockOrRestart(parentVersion, needRestart);
+                if (needRestart) break;
+                node->upgradeToWriteLockOrRestart(version, needRestart);
+                if (needRestart) {
+                    parent->writeUnlock();
+                    break;
+                }
+
+                int siblingIndex = indexInParent > 0 ? indexInParent - 1 : indexInParent + 1;
+                Node* sibling = parent->child(siblingIndex);
+                uint64_t siblingVersion = sibling->readLockOrRestart(needRestart);
+                if (!needRestart) {sibling->upgradeToWriteLockOrRestart(siblingVersion, needRestart);}
+                if (needRestart) {
+                    node->writeUnlock();
+                    parent->writeUnlock();
+                    break;
+                }
+
+                refillChild(parent, indexInParent, node, sibling);
+                needRestart = true;
+                break;
+            }
+            if (node->isLeaf) break;
+
+            int i = childIndex(node, key);
+            Node* child = node->child(i);
+            if (!child) {needRestart = true; break;}
+            uint64_t childVersion = child->readLockOrRestart(needRestart);
+            if (needRestart) break;
+            node->readUnlockOrRestart(version, needRestart);
+            if (needRestart) break;
+
+            parent = node;
+            parentVersion = version;
+            indexInParent = i;
+            node = child;
+            version = childVersion;
+        }
+        if (needRestart) continue;
+
+        // The leaf has keys to spare, so only the leaf itself needs to be locked
+        node->upgradeToWriteLockOrRestart(version, needRestart);
+        if (needRestart) continue;
+
+        int numKeys = node->count();
+        int i = NodeSearch::lowerBound(node->keys, numKeys, key);
+        if (i == numKeys || node->keys[i] != key) {
+            node->writeUnlock();
+            return false;
+        }
+
+        void* removedValue = node->slots[i].load(memory_order_relaxed);
+        for (int j = i + 1; j < numKeys; j++) {
+            node->keys[j - 1] = node->keys[j];
+            node->setSlot(j - 1, node->slots[j].load(memory_order_relaxed));
+        }
+        node->setSlot(numKeys - 1, nullptr);
+        node->numKeys.store(numKeys - 1, memory_order_relaxed);
+        node->writeUnlock();
+
+        // Readers that found the value before it was unlinked may still be copying it
+        reclaimer.retire(removedValue, freeValue);
+        return true;
+    }
+}
+
+// Splits a write-locked node, adding its new right sibling to the write-locked
+// parent (or to a new root when the node is the root).
+void ConcurrentBPlusTree::splitChild(Node* parent, Node* node) {
+    Node* sibling = newNode(node->isLeaf);
+    int numKeys = node->count();
+    int firstMoved;   // First key that moves to the sibling
+    int separator;
+
+    if (node->isLeaf) {
+        firstMoved = (numKeys + 1) / 2;
+        separator = node->keys[firstMoved];
+        for (int i = firstMoved; i < numKeys; i++) {
+            sibling->keys[i - firstMoved] = node->keys[i];
+            sibling->setSlot(i - firstMoved, node->slots[i].load(memory_order_relaxed));
+            node->setSlot(i, nullptr);
+        }
+        sibling->numKeys.store(numKeys - firstMoved, memory_order_relaxed);
+        node->numKeys.store(firstMoved, memory_order_relaxed);
+    } else {
+        int middleIndex = numKeys / 2;
+        firstMoved = middleIndex + 1;
+        separator = node->keys[middleIndex];
+        for (int i = firstMoved; i < numKeys; i++) {
+            sibling->keys[i - firstMoved] = node->keys[i];
+        }
+        for (int i = firstMoved; i <= numKeys; i++) {
+            sibling->setSlot(i - firstMoved, node->slots[i].load(memory_order_relaxed));
+            node->setSlot(i, nullptr);
+        }
+        sibling->numKeys.store(numKeys - firstMoved, memory_order_relaxed);
+        node->numKeys.store(middleIndex, memory_order_relaxed);
+    }
+
+    if (parent) {
+        insertIntoInterior(parent, separator, sibling);
+    } else {
+        Node* newRoot = newNode(false);
+        newRoot->keys[0] = separator;
+        newRoot->setSlot(0, node);
+        newRoot->setSlot(1, sibling);
+        newRoot->numKeys.store(1, memory_order_relaxed);
+        root.store(newRoot);
+    }
+}
+
+void ConcurrentBPlusTree::insertIntoInterior(Node* node, int key, Node* rightChild) {
+    int numKeys = node->count();
+    int i = NodeSearch::lowerBound(node->keys, numKeys, key);
+    for (int j = numKeys; j > i; j--) {
+        node->keys[j] = node->keys[j - 1];
+        node->setSlot(j + 1, node->slots[j].load(memory_order_relaxed));
+    }
+    node->keys[i] = key;
+    node->setSlot(i + 1, rightChild);
+    node->numKeys.store(numKeys + 1, memory_order_relaxed);
+}
+
+// Tops up the minimal child at index by borrowing from its sibling, or merges
+// the two if the sibling has no keys to spare. The sibling is the left neighbour
+// unless node is the first child. Expects parent, node and sibling to be
+// write-locked and unlocks all three.
+void ConcurrentBPlusTree::refillChild(Node* parent, int index, Node* node, Node* sibling) {
+    bool siblingIsLeft = index > 0;
+    int numKeys = node->count();
+    int siblingKeys = sibling->count();
+
+    if (siblingKeys > minKeys) {
+        if (siblingIsLeft) {
+            // Move the sibling's last entry to the front of the node
+            for (int j = numKeys; j > 0; j--) {
+                node->keys[j] = node->keys[j - 1];
+            }
+            int lastSlot = node->isLeaf ? numKeys : numKeys + 1;
+            for (int j = lastSlot; j > 0; j--) {
+                node->setSlot(j, node->slots[j - 1].load(memory_order_relaxed));
+            }
+            if (node->isLeaf) {
+                node->keys[0] = sibling->keys[siblingKeys - 1];
+                node->setSlot(0, sibling->slots[siblingKeys - 1].load(memory_order_relaxed));
+                sibling->setSlot(siblingKeys - 1, nullptr);
+                parent->keys[index - 1] = node->keys[0];
+            } else {
+                node->keys[0] = parent->keys[index - 1];
+                node->setSlot(0, sibling->slots[siblingKeys].load(memory_order_relaxed));
+                sibling->setSlot(siblingKeys, nullptr);
+                parent->keys[index - 1] = sibling->keys[siblingKeys - 1];
+            }
+        } else {
+            // Move the sibling's first entry to the end of the node
+            int siblingSlots = sibling->isLeaf ? siblingKeys : siblingKeys + 1;
+            if (node->isLeaf) {
+                node->keys[numKeys] = sibling->keys[0];
+                node->setSlot(numKeys, sibling->slots[0].load(memory_order_relaxed));
+            } else {
+                node->keys[numKeys] = parent->keys[index];
+                node->setSlot(numKeys + 1, sibling->slots[0].load(memory_order_relaxed));
+                parent->keys[index] = sibling->keys[0];
+            }
+            for (int j = 1; j < siblingKeys; j++) {
+                sibling->keys[j - 1] = sibling->keys[j];
+            }
+            for (int j = 1; j < siblingSlots; j++) {
+                sibling->setSlot(j - 1, sibling->slots[j].load(memory_order_relaxed));
+            }
+            sibling->setSlot(siblingSlots - 1, nullptr);
+            if (node->isLeaf) {parent->keys[index] = sibling->keys[0];}
+        }
+
+        node->numKeys.store(numKeys + 1, memory_order_relaxed);
+        sibling->numKeys.store(siblingKeys - 1, memory_order_relaxed);
+        sibling->writeUnlock();
+        node->writeUnlock();
+        parent->writeUnlock();
+        return;
+    }
+
+    // Merge the right node of the pair into the left one
+    Node* left = siblingIsLeft ? sibling : node;
+    Node* right = siblingIsLeft ? node : sibling;
+    int separatorIndex = siblingIsLeft ? index - 1 : index;
+    int leftKeys = left->count();
+    int rightKeys = right->count();
+
+    if (left->isLeaf) {
+        for (int j = 0; j < rightKeys; j++) {
+            left->keys[leftKeys + j] = right->keys[j];
+            left->setSlot(leftKeys + j, right->slots[j].load(memory_order_relaxed));
+        }
+        left->numKeys.store(leftKeys + rightKeys, memory_order_relaxed);
+    } else {
+        left->keys[leftKeys] = parent->keys[separatorIndex];
+        for (int j = 0; j < rightKeys; j++) {
+            left->keys[leftKeys + 1 + j] = right->keys[j];
+        }
+        for (int j = 0; j <= rightKeys; j++) {
+            left->setSlot(leftKeys + 1 + j, right->slots[j].load(memory_order_relaxed));
+        }
+        left->numKeys.store(leftKeys + 1 + rightKeys, memory_order_relaxed);
+    }
+
+    // Drop the separator and the pointer to the right node from the parent
+    int parentKeys = parent->count();
+    for (int j = separatorIndex + 1; j < parentKeys; j++) {
+        parent->keys[j - 1] = parent->keys[j];
+    }
+    for (int j = separatorIndex + 2; j <= parentKeys; j++) {
+        parent->setSlot(j - 1, parent->slots[j].load(memory_order_relaxed));
+    }
+    parent->setSlot(parentKeys, nullptr);
+    parent->numKeys.store(parentKeys - 1, memory_order_relaxed);
+
+    left->writeUnlock();
+    right->writeUnlockObsolete();
+    reclaimer.retire(right, freeNode);
+
+    // Shrink the tree once the root runs out of keys
+    if (parent == root.load() && parent->count() == 0) {
+        root.store(left);
+        parent->writeUnlockObsolete();
+        reclaimer.retire(parent, freeNode);
+    } else {
+        parent->writeUnlock();
+    }
+}
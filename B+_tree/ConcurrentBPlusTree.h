@@ -0,0 +1,100 @@
+#ifndef CONCURRENT_BPLUSTREE_H
+#define CONCURRENT_BPLUSTREE_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// Epoch-based reclamation. Threads enter() before touching shared nodes and
+// exit() afterwards; memory handed to retire() is only freed once every thread
+// that might still be reading it has left the epoch it was retired in. Each
+// thread keeps its own retire list and collects it itself, so retiring never
+// waits for another thread.
+class EpochReclaimer {
+public:
+    static const int kMaxThreads = 256;
+
+    EpochReclaimer();
+    ~EpochReclaimer();  // Frees everything still waiting to be reclaimed
+    void enter();
+    void exit();
+    void retire(void* pointer, void (*deleter)(void*));
+
+    EpochReclaimer(const EpochReclaimer&) = delete;
+    EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+private:
+    struct Retired {
+        void* pointer;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+    struct alignas(64) Slot {
+        atomic<uint64_t> epoch;  // 0 when the thread is not inside an operation
+        vector<Retired> retired;  // Only touched by the thread holding the slot
+    };
+
+    atomic<uint64_t> globalEpoch;
+    Slot slots[kMaxThreads];
+
+    void collect(vector<Retired>& retired);
+};
+
+// Thread-safe B+ tree using optimistic lock coupling. Every node carries a
+// version word (bit 0: obsolete, bit 1: locked, upper bits: counter). Readers
+// never write shared memory: they remember each node's version, read it, and
+// restart if the version changed. Writers lock only the nodes they modify - a
+// leaf, or a node plus its parent (and a sibling when removing). Full nodes are
+// split and minimal nodes are refilled on the way down, so a change never has
+// to propagate back up the tree.
+class ConcurrentBPlusTree {
+private:
+    struct Node {
+        atomic<uint64_t> version;
+        atomic<int> numKeys;
+        bool isLeaf;
+        int* keys;               // maxKeys keys, read optimistically
+        atomic<void*>* slots;    // maxKeys + 1 children (Node*), or maxKeys values (const string*)
+
+        int count() const {return numKeys.load(memory_order_relaxed);}
+        Node* child(int i) const {return static_cast<Node*>(slots[i].load(memory_order_relaxed));}
+        const string* value(int i) const {return static_cast<const string*>(slots[i].load(memory_order_relaxed));}
+        void setSlot(int i, void* pointer) {slots[i].store(pointer, memory_order_relaxed);}
+
+        uint64_t readLockOrRestart(bool& needRestart) const;
+        void readUnlockOrRestart(uint64_t startVersion, bool& needRestart) const;
+        void upgradeToWriteLockOrRestart(uint64_t& currentVersion, bool& needRestart);
+        void writeUnlock();
+        void writeUnlockObsolete();
+    };
+
+    atomic<Node*> root;
+    int maxKeys;
+    int minKeys;
+    mutable EpochReclaimer reclaimer;
+
+    Node* newNode(bool isLeaf);
+    static void freeNode(void* node);
+    static void freeValue(void* value);
+    void destroyTree(Node* node);
+
+    int childIndex(const Node* node, int key) const;
+    void splitChild(Node* parent, Node* node);
+    void refillChild(Node* parent, int index, Node* node, Node* sibling);
+    void insertIntoInterior(Node* node, int key, Node* rightChild);
+
+public:
+    ConcurrentBPlusTree(int maxKeys);
+    ~ConcurrentBPlusTree();
+    bool insert(int key, const string& value);
+    bool remove(int key);
+    string find(int key) const;
+
+    ConcurrentBPlusTree(const ConcurrentBPlusTree&) = delete;
+    ConcurrentBPlusTree& operator=(const ConcurrentBPlusTree&) = delete;
+};
+
+#endif
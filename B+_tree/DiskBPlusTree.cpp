@@ -0,0 +1,572 @@
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "DiskBPlusTree.h"
+#include "NodeSearch.h"
+
+using namespace std;
+
+namespace {
+
+const char kMagic[8] = {'B', 'P', 'T', 'R', 'E', 'E', '0', '1'};
+const uint32_t kFormatVersion = 1;
+const size_t kMinCachePages = 64;
+
+enum PageType : uint16_t {
+    kFreePage = 0,
+    kLeafPage = 1,
+    kInteriorPage = 2,
+};
+
+struct PageHeader {
+    uint16_t type;
+    uint16_t numKeys;
+    uint16_t heapStart;  // Leaves: offset of the lowest value byte
+    uint16_t reserved;
+    uint32_t next;       // Leaves: the next leaf; free pages: the next free page
+    uint32_t reserved2;
+};
+
+struct LeafEntry {
+    int32_t key;
+    uint16_t offset;
+    uint16_t length;
+};
+
+// A leaf entry gathered for rewriting one or two leaves
+struct Record {
+    int32_t key;
+    const char* bytes;
+    uint16_t length;
+};
+
+const size_t kLeafSpace = kPageSize - sizeof(PageHeader);
+const int kInteriorMaxKeys = (kPageSize - sizeof(PageHeader) - sizeof(uint32_t)) / (sizeof(int32_t) + sizeof(uint32_t));
+const int kInteriorMinKeys = kInteriorMaxKeys / 2;
+
+PageHeader* header(char* page) {return reinterpret_cast<PageHeader*>(page);}
+LeafEntry* entries(char* page) {return reinterpret_cast<LeafEntry*>(page + sizeof(PageHeader));}
+int32_t* interiorKeys(char* page) {return reinterpret_cast<int32_t*>(page + sizeof(PageHeader));}
+uint32_t* interiorChildren(char* page) {
+    return reinterpret_cast<uint32_t*>(page + sizeof(PageHeader) + kInteriorMaxKeys * sizeof(int32_t));
+}
+
+void initLeaf(char* page) {
+    PageHeader* head = header(page);
+    head->type = kLeafPage;
+    head->numKeys = 0;
+    head->heapStart = kPageSize;
+    head->next = 0;
+}
+
+// Bytes between the entry array and the value heap
+size_t leafFreeBytes(char* page) {
+    PageHeader* head = header(page);
+    return head->heapStart - sizeof(PageHeader) - head->numKeys * sizeof(LeafEntry);
+}
+
+// Bytes the live entries and values would take after compaction
+size_t leafUsedBytes(char* page) {
+    int n = header(page)->numKeys;
+    size_t used = n * sizeof(LeafEntry);
+    for (int i = 0; i < n; i++) {
+        used += entries(page)[i].length;
+    }
+    return used;
+}
+
+int leafLowerBound(char* page, int key) {
+    LeafEntry* first = entries(page);
+    LeafEntry* last = first + header(page)->numKeys;
+    return lower_bound(first, last, key, [](const LeafEntry& entry, int k) {return entry.key < k;}) - first;
+}
+
+void collectRecords(char* page, vector<Record>& records) {
+    for (int i = 0; i < header(page)->numKeys; i++) {
+        LeafEntry& entry = entries(page)[i];
+        records.push_back({entry.key, page + entry.offset, entry.length});
+    }
+}
+
+// Replaces a leaf's contents with the given records, packing the values at the
+// end of the page. The records must not point into the page being written.
+void writeLeaf(char* page, const Record* records, size_t count) {
+    PageHeader* head = header(page);
+    head->numKeys = count;
+    head->heapStart = kPageSize;
+    for (size_t i = 0; i < count; i++) {
+        head->heapStart -= records[i].length;
+        memcpy(page + head->heapStart, records[i].bytes, records[i].length);
+        entries(page)[i] = {records[i].key, head->heapStart, records[i].length};
+    }
+}
+
+// Squeezes out the space left behind by removed values
+void compactLeaf(char* page) {
+    alignas(8) char copy[kPageSize];
+    memcpy(copy, page, kPageSize);
+    vector<Record> records;
+    collectRecords(copy, records);
+    writeLeaf(page, records.data(), records.size());
+}
+
+void insertEntry(char* page, int index, int key, const string& value) {
+    PageHeader* head = header(page);
+    LeafEntry* leafEntries = entries(page);
+    memmove(leafEntries + index + 1, leafEntries + index, (head->numKeys - index) * sizeof(LeafEntry));
+    head->heapStart -= value.size();
+    memcpy(page + head->heapStart, value.data(), value.size());
+    leafEntries[index] = {key, head->heapStart, (uint16_t)value.size()};
+    head->numKeys++;
+}
+
+// Index that divides the records into two runs of about the same number of bytes
+size_t splitPoint(const vector<Record>& records) {
+    size_t total = 0;
+    for (const Record& record : records) {
+        total += sizeof(LeafEntry) + record.length;
+    }
+    size_t running = 0;
+    size_t index = 0;
+    while (index < records.size() - 1 && running * 2 < total) {
+        running += sizeof(LeafEntry) + records[index].length;
+        index++;
+    }
+    return max(index, (size_t)1);
+}
+
+void writeInterior(char* page, const int32_t* keys, const uint32_t* children, int count) {
+    PageHeader* head = header(page);
+    head->type = kInteriorPage;
+    head->numKeys = count;
+    memmove(interiorKeys(page), keys, count * sizeof(int32_t));
+    memmove(interiorChildren(page), children, (count + 1) * sizeof(uint32_t));
+}
+
+// Removes the key at keyIndex and the child to its right
+void removeFromInterior(char* page, int keyIndex) {
+    PageHeader* head = header(page);
+    int n = head->numKeys;
+    int32_t* keys = interiorKeys(page);
+    uint32_t* children = interiorChildren(page);
+    memmove(keys + keyIndex, keys + keyIndex + 1, (n - keyIndex - 1) * sizeof(int32_t));
+    memmove(children + keyIndex + 1, children + keyIndex + 2, (n - keyIndex - 1) * sizeof(uint32_t));
+    head->numKeys--;
+}
+
+}  // namespace
+
+// Disk tree initialization
+DiskBPlusTree::DiskBPlusTree(const string& path, size_t cachePages, const WalOptions& walOptions)
+    : walOptions(walOptions), opsSinceCheckpoint(0), recovering(false), replayedOperations(0) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw runtime_error("DiskBPlusTree: cannot open " + path);
+    }
+
+    WriteAheadLog::Recovery recovery;
+    try {
+        wal.reset(new WriteAheadLog(path + ".wal", walOptions));
+        recovery = wal->recover();
+
+        // The last checkpoint may have been cut short partway through writing its pages
+        for (const WriteAheadLog::Record& image : recovery.pageImages) {
+            // An image of another size was logged for a different page size
+            if (image.payload.size() != kPageSize) {
+                throw runtime_error("DiskBPlusTree: " + path + " is not a tree file");
+            }
+            if (pwrite(fd, image.payload.data(), kPageSize, (off_t)image.pageId * kPageSize) != (ssize_t)kPageSize) {
+                throw runtime_error("DiskBPlusTree: cannot restore page " + to_string(image.pageId));
+            }
+        }
+        if (!recovery.pageImages.empty()) {fsync(fd);}
+    } catch (const exception&) {
+        wal.reset();
+        close(fd);
+        throw;
+    }
+    pool.reset(new BufferPool(fd, max(cachePages, kMinCachePages)));
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size == 0) {
+        createEmpty();
+    } else {
+        PageHandle metaPage = pool->fetch(0);
+        memcpy(&meta, metaPage.data(), sizeof(Meta));
+        if (memcmp(meta.magic, kMagic, sizeof(kMagic)) != 0 || meta.version != kFormatVersion || meta.pageSize != kPageSize) {
+            metaPage = PageHandle();
+            pool.reset();
+            wal.reset();
+            close(fd);
+            throw runtime_error("DiskBPlusTree: " + path + " is not a tree file");
+        }
+    }
+
+    replay(recovery);
+    checkpoint();
+}
+
+// Disk tree deletion
+DiskBPlusTree::~DiskBPlusTree() {
+    try {
+        checkpoint();
+    } catch (const exception&) {
+        // Nothing useful can be done about a failed write while closing
+    }
+    wal.reset();
+    pool.reset();
+    close(fd);
+}
+
+// New file: the metadata page and an empty root leaf
+void DiskBPlusTree::createEmpty() {
+    memcpy(meta.magic, kMagic, sizeof(kMagic));
+    meta.version = kFormatVersion;
+    meta.pageSize = kPageSize;
+    meta.numPages = 1;
+    meta.freeListHead = 0;
+    meta.reserved = 0;
+    meta.numEntries = 0;
+
+    PageHandle root = allocatePage();
+    initLeaf(root.data());
+    meta.rootPage = root.pageId();
+}
+
+// Reapplies the logged operations the last checkpoint does not cover. Pages
+// may fill the pool while replaying, so checkpoints can run here too; they
+// record how far the replay got and leave the log in place until it is done.
+void DiskBPlusTree::replay(WriteAheadLog::Recovery& recovery) {
+    recovering = true;
+    replayedOperations = recovery.firstOperation;
+    for (const WriteAheadLog::Record& operation : recovery.operations) {
+        if (operation.type == WriteAheadLog::kInsert) {
+            insert(operation.key, operation.payload);
+        } else {
+            remove(operation.key);
+        }
+        replayedOperations++;
+        maybeCheckpoint();
+    }
+    recovering = false;
+}
+
+void DiskBPlusTree::flush() {
+    wal->sync();
+}
+
+// Logs the image of every changed page, then writes them to the file. Once
+// the file is synced the log has nothing left to redo and is emptied.
+void DiskBPlusTree::checkpoint() {
+    writeMeta();
+    pool->forEachDirty([this](uint32_t pageId, const char* page) {
+        wal->logPageImage(pageId, page, kPageSize);
+    });
+    wal->logCheckpointEnd(recovering ? replayedOperations : wal->operationsLogged());
+    wal->sync();
+
+    pool->flushAll();
+    if (fsync(fd) != 0) {
+        throw runtime_error("DiskBPlusTree: cannot sync the tree file");
+    }
+    if (!recovering) {wal->reset();}
+    opsSinceCheckpoint = 0;
+}
+
+// Dirty pages cannot leave the pool before a checkpoint, so one is also taken
+// when they fill half of it
+void DiskBPlusTree::maybeCheckpoint() {
+    opsSinceCheckpoint++;
+    if (opsSinceCheckpoint >= walOptions.checkpointEveryOps || pool->dirtyCount() > pool->capacity() / 2) {
+        checkpoint();
+    }
+}
+
+uint64_t DiskBPlusTree::size() const {
+    return meta.numEntries;
+}
+
+void DiskBPlusTree::writeMeta() {
+    PageHandle page = pool->fetch(0);
+    memcpy(page.data(), &meta, sizeof(Meta));
+    page.markDirty();
+}
+
+// Reuses a page from the free list, or grows the file by one page
+PageHandle DiskBPlusTree::allocatePage() {
+    if (meta.freeListHead != 0) {
+        PageHandle page = pool->fetch(meta.freeListHead);
+        meta.freeListHead = header(page.data())->next;
+        memset(page.data(), 0, kPageSize);
+        page.markDirty();
+        return page;
+    }
+    return pool->create(meta.numPages++);
+}
+
+void DiskBPlusTree::freePage(uint32_t pageId) {
+    PageHandle page = pool->fetch(pageId);
+    memset(page.data(), 0, kPageSize);
+    header(page.data())->type = kFreePage;
+    header(page.data())->next = meta.freeListHead;
+    page.markDirty();
+    meta.freeListHead = pageId;
+}
+
+// Descends to the leaf that should contain key, recording the path taken
+PageHandle DiskBPlusTree::findLeaf(int key, vector<PathStep>& path) {
+    path.clear();
+    PageHandle page = pool->fetch(meta.rootPage);
+    while (header(page.data())->type == kInteriorPage) {
+        char* data = page.data();
+        int index = NodeSearch::upperBound(interiorKeys(data), header(data)->numKeys, key);
+        path.push_back({page.pageId(), index});
+        page = pool->fetch(interiorChildren(data)[index]);
+    }
+    return page;
+}
+
+bool DiskBPlusTree::insert(int key, const string& value) {
+    if (value.size() > kMaxValueSize) return false;
+
+    vector<PathStep> path;
+    PageHandle leaf = findLeaf(key, path);
+    char* data = leaf.data();
+    int index = leafLowerBound(data, key);
+    if (index < header(data)->numKeys && entries(data)[index].key == key) return false;
+
+    size_t needed = sizeof(LeafEntry) + value.size();
+    if (leafFreeBytes(data) < needed && leafUsedBytes(data) + needed <= kLeafSpace) {
+        compactLeaf(data);
+    }
+
+    if (leafFreeBytes(data) >= needed) {
+        insertEntry(data, index, key, value);
+        leaf.markDirty();
+    } else {
+        int separator;
+        uint32_t rightPage;
+        splitLeaf(leaf, key, value, separator, rightPage);
+        leaf = PageHandle();
+        insertIntoParents(path, separator, rightPage);
+    }
+    meta.numEntries++;
+
+    if (!recovering) {
+        wal->logInsert(key, value);
+        maybeCheckpoint();
+    }
+    return true;
+}
+
+// Splits a full leaf, with the new entry, into two leaves holding about the same number of bytes
+void DiskBPlusTree::splitLeaf(PageHandle& leaf, int key, const string& value, int& separator, uint32_t& rightPage) {
+    alignas(8) char copy[kPageSize];
+    memcpy(copy, leaf.data(), kPageSize);
+
+    vector<Record> records;
+    records.reserve(header(copy)->numKeys + 1);
+    collectRecords(copy, records);
+    int index = leafLowerBound(copy, key);
+    records.insert(records.begin() + index, {key, value.data(), (uint16_t)value.size()});
+
+    size_t split = splitPoint(records);
+    PageHandle right = allocatePage();
+    initLeaf(right.data());
+    header(right.data())->next = header(copy)->next;
+    writeLeaf(right.data(), records.data() + split, records.size() - split);
+    writeLeaf(leaf.data(), records.data(), split);
+    header(leaf.data())->next = right.pageId();
+    leaf.markDirty();
+    right.markDirty();
+
+    separator = records[split].key;
+    rightPage = right.pageId();
+}
+
+// Adds the separator and new right page to the parents on the path, splitting them as needed
+void DiskBPlusTree::insertIntoParents(vector<PathStep>& path, int separator, uint32_t rightPage) {
+    while (!path.empty()) {
+        PathStep step = path.back();
+        path.pop_back();
+
+        PageHandle node = pool->fetch(step.pageId);
+        char* data = node.data();
+        int n = header(data)->numKeys;
+        int32_t* keys = interiorKeys(data);
+        uint32_t* children = interiorChildren(data);
+
+        if (n < kInteriorMaxKeys) {
+            memmove(keys + step.childIndex + 1, keys + step.childIndex, (n - step.childIndex) * sizeof(int32_t));
+            memmove(children + step.childIndex + 2, children + step.childIndex + 1, (n - step.childIndex) * sizeof(uint32_t));
+            keys[step.childIndex] = separator;
+            children[step.childIndex + 1] = rightPage;
+            header(data)->numKeys++;
+            node.markDirty();
+            return;
+        }
+
+        // Full: lay out the overflowing node and split it around the middle key
+        vector<int32_t> allKeys(keys, keys + n);
+        vector<uint32_t> allChildren(children, children + n + 1);
+        allKeys.insert(allKeys.begin() + step.childIndex, separator);
+        allChildren.insert(allChildren.begin() + step.childIndex + 1, rightPage);
+
+        int middle = (n + 1) / 2;
+        PageHandle right = allocatePage();
+        writeInterior(data, allKeys.data(), allChildren.data(), middle);
+        writeInterior(right.data(), allKeys.data() + middle + 1, allChildren.data() + middle + 1, n - middle);
+        node.markDirty();
+        right.markDirty();
+
+        separator = allKeys[middle];
+        rightPage = right.pageId();
+    }
+
+    // The root was split, so the tree grows by one level
+    PageHandle root = allocatePage();
+    uint32_t children[2] = {meta.rootPage, rightPage};
+    writeInterior(root.data(), &separator, children, 1);
+    root.markDirty();
+    meta.rootPage = root.pageId();
+}
+
+bool DiskBPlusTree::remove(int key) {
+    vector<PathStep> path;
+    PageHandle leaf = findLeaf(key, path);
+    char* data = leaf.data();
+    PageHeader* head = header(data);
+    int index = leafLowerBound(data, key);
+    if (index >= head->numKeys || entries(data)[index].key != key) return false;
+
+    // The value bytes stay behind until the leaf is next compacted
+    memmove(entries(data) + index, entries(data) + index + 1, (head->numKeys - index - 1) * sizeof(LeafEntry));
+    head->numKeys--;
+    leaf.markDirty();
+    meta.numEntries--;
+
+    if (!path.empty() && leafUsedBytes(data) < kLeafSpace / 4) {
+        rebalanceLeaf(path, leaf);
+    }
+    leaf = PageHandle();
+
+    if (!recovering) {
+        wal->logRemove(key);
+        maybeCheckpoint();
+    }
+    return true;
+}
+
+// Merges an under-full leaf with a sibling, or evens out their bytes if both do not fit in one page
+void DiskBPlusTree::rebalanceLeaf(vector<PathStep>& path, PageHandle& leaf) {
+    PathStep step = path.back();
+    path.pop_back();
+
+    PageHandle parent = pool->fetch(step.pageId);
+    char* parentData = parent.data();
+    bool siblingIsLeft = step.childIndex > 0;
+    int separatorIndex = siblingIsLeft ? step.childIndex - 1 : step.childIndex;
+    PageHandle sibling = pool->fetch(interiorChildren(parentData)[siblingIsLeft ? step.childIndex - 1 : step.childIndex + 1]);
+    PageHandle& left = siblingIsLeft ? sibling : leaf;
+    PageHandle& right = siblingIsLeft ? leaf : sibling;
+
+    alignas(8) char leftCopy[kPageSize];
+    alignas(8) char rightCopy[kPageSize];
+    memcpy(leftCopy, left.data(), kPageSize);
+    memcpy(rightCopy, right.data(), kPageSize);
+    vector<Record> records;
+    collectRecords(leftCopy, records);
+    collectRecords(rightCopy, records);
+
+    if (leafUsedBytes(leftCopy) + leafUsedBytes(rightCopy) <= kLeafSpace) {
+        writeLeaf(left.data(), records.data(), records.size());
+        header(left.data())->next = header(rightCopy)->next;
+        left.markDirty();
+
+        removeFromInterior(parentData, separatorIndex);
+        parent.markDirty();
+        freePage(right.pageId());
+        rebalanceInterior(path, parent);
+        return;
+    }
+
+    size_t split = splitPoint(records);
+    writeLeaf(left.data(), records.data(), split);
+    writeLeaf(right.data(), records.data() + split, records.size() - split);
+    interiorKeys(parentData)[separatorIndex] = records[split].key;
+    left.markDirty();
+    right.markDirty();
+    parent.markDirty();
+}
+
+// Fixes an interior page that lost a key: collapses an empty root, and merges
+// an under-full page with a sibling or rebalances the two
+void DiskBPlusTree::rebalanceInterior(vector<PathStep>& path, PageHandle& node) {
+    char* data = node.data();
+    int n = header(data)->numKeys;
+    if (path.empty()) {
+        if (n == 0) {
+            uint32_t oldRoot = node.pageId();
+            meta.rootPage = interiorChildren(data)[0];
+            freePage(oldRoot);
+        }
+        return;
+    }
+    if (n >= kInteriorMinKeys) return;
+
+    PathStep step = path.back();
+    path.pop_back();
+
+    PageHandle parent = pool->fetch(step.pageId);
+    char* parentData = parent.data();
+    bool siblingIsLeft = step.childIndex > 0;
+    int separatorIndex = siblingIsLeft ? step.childIndex - 1 : step.childIndex;
+    PageHandle sibling = pool->fetch(interiorChildren(parentData)[siblingIsLeft ? step.childIndex - 1 : step.childIndex + 1]);
+    PageHandle& left = siblingIsLeft ? sibling : node;
+    PageHandle& right = siblingIsLeft ? node : sibling;
+
+    // Both pages' keys with the separator between them
+    char* leftData = left.data();
+    char* rightData = right.data();
+    int leftCount = header(leftData)->numKeys;
+    int rightCount = header(rightData)->numKeys;
+    vector<int32_t> keys(interiorKeys(leftData), interiorKeys(leftData) + leftCount);
+    keys.push_back(interiorKeys(parentData)[separatorIndex]);
+    keys.insert(keys.end(), interiorKeys(rightData), interiorKeys(rightData) + rightCount);
+    vector<uint32_t> children(interiorChildren(leftData), interiorChildren(leftData) + leftCount + 1);
+    children.insert(children.end(), interiorChildren(rightData), interiorChildren(rightData) + rightCount + 1);
+
+    int total = keys.size();
+    if (total <= kInteriorMaxKeys) {
+        writeInterior(leftData, keys.data(), children.data(), total);
+        left.markDirty();
+        removeFromInterior(parentData, separatorIndex);
+        parent.markDirty();
+        freePage(right.pageId());
+        rebalanceInterior(path, parent);
+        return;
+    }
+
+    int middle = total / 2;
+    writeInterior(leftData, keys.data(), children.data(), middle);
+    writeInterior(rightData, keys.data() + middle + 1, children.data() + middle + 1, total - middle - 1);
+    interiorKeys(parentData)[separatorIndex] = keys[middle];
+    left.markDirty();
+    right.markDirty();
+    parent.markDirty();
+}
+
+string DiskBPlusTree::find(int key) {
+    vector<PathStep> path;
+    PageHandle leaf = findLeaf(key, path);
+    char* data = leaf.data();
+    int index = leafLowerBound(data, key);
+    if (index < header(data)->numKeys && entries(data)[index].key == key) {
+        LeafEntry& entry = entries(data)[index];
+        return string(data + entry.offset, entry.length);
+    }
+    return "<empty>";
+}
@@ -0,0 +1,95 @@
+#ifndef DISK_BPLUSTREE_H
+#define DISK_BPLUSTREE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "BufferPool.h"
+#include "WriteAheadLog.h"
+
+using namespace std;
+
+// B+ tree stored in a file of fixed-size pages and read through a BufferPool,
+// so the tree can be much larger than memory. Page 0 holds the metadata (root
+// page, page count, free list); every other page is a leaf, an interior node,
+// or free. Pages refer to each other by page ID and have no parent links, so
+// splits and merges walk back up the path recorded on the way down.
+//
+// Leaves are slotted pages: a sorted array of (key, offset, length) entries
+// grows from the front and the value bytes grow from the back. Interior pages
+// hold plain key and child-page-ID arrays. Opening an existing file reads only
+// the metadata page; everything else is paged in on demand.
+//
+// Every insert and remove is recorded in a write-ahead log next to the file
+// (path + ".wal") before it returns; see WalOptions for how log writes are
+// grouped into fsyncs. Changed pages stay in the buffer pool until a
+// checkpoint, which logs their images, writes them to the file and empties the
+// log. Opening the file after a crash finishes an interrupted checkpoint from
+// the log and replays the operations logged since, so recovery time depends on
+// the checkpoint interval rather than the size of the tree.
+//
+// Pages are written in the machine's byte order.
+class DiskBPlusTree {
+public:
+    static const size_t kMaxValueSize = 1024;
+    static const size_t kDefaultCachePages = 1024;
+
+    // Opens the tree stored at path, creating the file if it does not exist,
+    // and recovers it from its log. Throws runtime_error if the file cannot be
+    // opened or is not a tree file.
+    DiskBPlusTree(const string& path, size_t cachePages = kDefaultCachePages, const WalOptions& walOptions = WalOptions());
+    ~DiskBPlusTree();  // Checkpoints and closes the file
+
+    bool insert(int key, const string& value);  // False for duplicates and values over kMaxValueSize
+    bool remove(int key);
+    string find(int key);
+    uint64_t size() const;
+    void flush();       // Makes every operation so far durable in the log
+    void checkpoint();  // Writes every changed page to the file and empties the log
+
+    DiskBPlusTree(const DiskBPlusTree&) = delete;
+    DiskBPlusTree& operator=(const DiskBPlusTree&) = delete;
+
+private:
+    struct Meta {
+        char magic[8];
+        uint32_t version;
+        uint32_t pageSize;
+        uint32_t rootPage;
+        uint32_t numPages;
+        uint32_t freeListHead;  // 0 when there are no free pages
+        uint32_t reserved;
+        uint64_t numEntries;
+    };
+
+    // A step of the path from the root: the interior page and the child taken
+    struct PathStep {
+        uint32_t pageId;
+        int childIndex;
+    };
+
+    int fd;
+    Meta meta;
+    unique_ptr<BufferPool> pool;
+    unique_ptr<WriteAheadLog> wal;
+    WalOptions walOptions;
+    uint64_t opsSinceCheckpoint;
+    bool recovering;              // Replaying the log: operations are not logged again
+    uint64_t replayedOperations;  // Log operations a checkpoint taken now would cover
+
+    PageHandle allocatePage();
+    void freePage(uint32_t pageId);
+    void writeMeta();
+    void createEmpty();
+    void replay(WriteAheadLog::Recovery& recovery);
+    void maybeCheckpoint();
+
+    PageHandle findLeaf(int key, vector<PathStep>& path);
+    void splitLeaf(PageHandle& leaf, int key, const string& value, int& separator, uint32_t& rightPage);
+    void insertIntoParents(vector<PathStep>& path, int separator, uint32_t rightPage);
+    void rebalanceLeaf(vector<PathStep>& path, PageHandle& leaf);
+    void rebalanceInterior(vector<PathStep>& path, PageHandle& node);
+};
+
+#endif
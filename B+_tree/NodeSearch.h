@@ -0,0 +1,105 @@
+#ifndef NODE_SEARCH_H
+#define NODE_SEARCH_H
+
+// Key search shared by every BPlusTree path that looks for a position in a node.
+// A branchless binary search narrows the range down to a small window, which is
+// then finished with a SIMD compare-and-count (AVX2 or SSE2, picked at build time)
+// or a plain counting loop on other targets.
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace NodeSearch {
+
+#if defined(__AVX2__)
+const int kWindow = 16;
+#elif defined(__SSE2__)
+const int kWindow = 8;
+#else
+const int kWindow = 4;
+#endif
+
+// Number of keys in keys[0..n) that are greater than key
+inline int countGreater(const int* keys, int n, int key) {
+    int count = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i needle = _mm256_set1_epi32(key);
+    for (; i + 8 <= n; i += 8) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(block, needle)));
+        count += __builtin_popcount(mask);
+    }
+#elif defined(__SSE2__)
+    __m128i needle = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, needle)));
+        count += __builtin_popcount(mask);
+    }
+#endif
+    for (; i < n; i++) {count += keys[i] > key;}
+    return count;
+}
+
+// Number of keys in keys[0..n) that are less than key
+inline int countLess(const int* keys, int n, int key) {
+    int count = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i needle = _mm256_set1_epi32(key);
+    for (; i + 8 <= n; i += 8) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, block)));
+        count += __builtin_popcount(mask);
+    }
+#elif defined(__SSE2__)
+    __m128i needle = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(needle, block)));
+        count += __builtin_popcount(mask);
+    }
+#endif
+    for (; i < n; i++) {count += keys[i] < key;}
+    return count;
+}
+
+// Index of the first key >= key (n if there is none)
+inline int lowerBound(const int* keys, int n, int key) {
+    const int* base = keys;
+    while (n > kWindow) {
+        int half = n / 2;
+        base = (base[half] < key) ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + countLess(base, n, key);
+}
+
+// Index of the first key > key (n if there is none)
+inline int upperBound(const int* keys, int n, int key) {
+    const int* base = keys;
+    while (n > kWindow) {
+        int half = n / 2;
+        base = (base[half] <= key) ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + n - countGreater(base, n, key);
+}
+
+// Key comparisons lowerBound or upperBound makes on n keys
+inline int comparisons(int n) {
+    int count = 0;
+    while (n > kWindow) {
+        n -= n / 2;
+        count++;
+    }
+    return count + n;
+}
+
+}
+
+#endif
@@ -0,0 +1,663 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <new>
+#include <cstring>
+#include "StringBPlusTree.h"
+
+using namespace std;
+
+namespace {
+
+int ceilDivide(int a, int b) {
+    return (a + b - 1) / b;
+}
+
+// Length of the longest common prefix of a and b
+size_t commonPrefix(string_view a, string_view b) {
+    size_t limit = min(a.size(), b.size());
+    size_t i = 0;
+    while (i < limit && a[i] == b[i]) {i++;}
+    return i;
+}
+
+// Suffix truncation: the shortest string s with left < s <= right, which is the
+// common prefix of the two and the first byte of right after it
+string shortestSeparator(string_view left, string_view right) {
+    return string(right.substr(0, commonPrefix(left, right) + 1));
+}
+
+// Heap bytes below which removed keys are not worth reclaiming
+const uint32_t kMinGarbage = 64;
+
+}  // namespace
+
+// String node initialization
+StringNode::StringNode(bool isLeaf, int capacity) :
+    numKeys(0),
+    capacity(capacity),
+    isLeaf(isLeaf),
+    prefixLength(0),
+    garbage(0),
+    next(nullptr)
+{
+    // Leaf values live inline in the node's block
+    if (isLeaf) {
+        for (int i = 0; i < capacity; i++) {
+            new (&values()[i]) string();
+        }
+    }
+}
+
+// String node deletion
+StringNode::~StringNode() {
+    if (isLeaf) {
+        for (int i = 0; i < capacity; i++) {
+            values()[i].~string();
+        }
+    }
+}
+
+string StringNode::key(int i) const {
+    string whole(prefix());
+    whole.append(suffix(i));
+    return whole;
+}
+
+uint32_t StringNode::headOf(string_view suffix) {
+    uint32_t head = 0;
+    for (size_t i = 0; i < 4; i++) {
+        head = (head << 8) | (i < suffix.size() ? (unsigned char)suffix[i] : 0);
+    }
+    return head;
+}
+
+size_t StringNode::slotOffset(int capacity) {
+    // Heads and key references follow the header; slots start at the next 8-byte boundary
+    return sizeof(StringNode) + (capacity * (sizeof(uint32_t) + sizeof(KeyRef)) + 7) / 8 * 8;
+}
+
+size_t StringNode::blockSize(bool isLeaf, int capacity) {
+    if (isLeaf) {
+        return slotOffset(capacity) + capacity * sizeof(string);
+    }
+    return slotOffset(capacity) + (capacity + 1) * sizeof(StringNode*);
+}
+
+
+// String tree initialization
+StringBPlusTree::StringBPlusTree(int maxKeys) :
+    root(nullptr),
+    maxKeys(maxKeys),
+    numEntries(0),
+    leafArena(StringNode::blockSize(true, maxKeys + 1)),
+    interiorArena(StringNode::blockSize(false, maxKeys + 1))
+{}
+
+// String tree destructor
+StringBPlusTree::~StringBPlusTree() {
+    destroyTree(root);
+}
+
+// String tree copy constructor
+StringBPlusTree::StringBPlusTree(const StringBPlusTree& other) :
+    root(nullptr),
+    maxKeys(other.maxKeys),
+    numEntries(other.numEntries),
+    leafArena(StringNode::blockSize(true, other.maxKeys + 1)),
+    interiorArena(StringNode::blockSize(false, other.maxKeys + 1))
+{
+    StringNode* previousLeaf = nullptr;
+    if (other.root) {root = copyNodes(other.root, previousLeaf);}
+}
+
+// String tree assignment operator
+StringBPlusTree& StringBPlusTree::operator=(const StringBPlusTree& other) {
+    if (this == &other) return *this;
+
+    destroyTree(root);
+    root = nullptr;
+    maxKeys = other.maxKeys;
+    numEntries = other.numEntries;
+    leafArena.reset(StringNode::blockSize(true, maxKeys + 1));
+    interiorArena.reset(StringNode::blockSize(false, maxKeys + 1));
+    StringNode* previousLeaf = nullptr;
+    if (other.root) {root = copyNodes(other.root, previousLeaf);}
+
+    return *this;
+}
+
+// String tree move constructor
+StringBPlusTree::StringBPlusTree(StringBPlusTree&& other) noexcept :
+    root(other.root),
+    maxKeys(other.maxKeys),
+    numEntries(other.numEntries),
+    leafArena(move(other.leafArena)),
+    interiorArena(move(other.interiorArena))
+{
+    other.root = nullptr;
+    other.numEntries = 0;
+}
+
+// String tree move assignment operator
+StringBPlusTree& StringBPlusTree::operator=(StringBPlusTree&& other) noexcept {
+    if (this == &other) return *this;
+
+    destroyTree(root);
+    root = other.root;
+    maxKeys = other.maxKeys;
+    numEntries = other.numEntries;
+    leafArena = move(other.leafArena);
+    interiorArena = move(other.interiorArena);
+    other.root = nullptr;
+    other.numEntries = 0;
+
+    return *this;
+}
+
+StringNode* StringBPlusTree::newNode(bool isLeaf) {
+    void* block = isLeaf ? leafArena.allocate() : interiorArena.allocate();
+    return new (block) StringNode(isLeaf, maxKeys + 1);
+}
+
+void StringBPlusTree::freeNode(StringNode* node) {
+    bool isLeaf = node->isLeaf;
+    node->~StringNode();
+    if (isLeaf) {
+        leafArena.release(node);
+    } else {
+        interiorArena.release(node);
+    }
+}
+
+void StringBPlusTree::destroyTree(StringNode* node) {
+    if (!node) return;
+    if (!node->isLeaf) {
+        for (int i = 0; i <= node->numKeys; i++) {
+            destroyTree(node->children()[i]);
+        }
+    }
+    freeNode(node);
+}
+
+// Recursive function to deep-copy nodes, relinking the leaves in order
+StringNode* StringBPlusTree::copyNodes(const StringNode* fromNode, StringNode*& previousLeaf) {
+    StringNode* toNode = newNode(fromNode->isLeaf);
+    toNode->numKeys = fromNode->numKeys;
+    toNode->prefixLength = fromNode->prefixLength;
+    toNode->garbage = fromNode->garbage;
+    toNode->heap = fromNode->heap;
+    copy(fromNode->heads(), fromNode->heads() + fromNode->numKeys, toNode->heads());
+    copy(fromNode->refs(), fromNode->refs() + fromNode->numKeys, toNode->refs());
+
+    if (fromNode->isLeaf) {
+        copy(fromNode->values(), fromNode->values() + fromNode->numKeys, toNode->values());
+        if (previousLeaf) {previousLeaf->next = toNode;}
+        previousLeaf = toNode;
+    } else {
+        for (int i = 0; i <= fromNode->numKeys; i++) {
+            toNode->children()[i] = copyNodes(fromNode->children()[i], previousLeaf);
+        }
+    }
+
+    return toNode;
+}
+
+// Compares a key, given as the part after the node's prefix and its head, with
+// key i of the node: negative, zero or positive as the key is smaller, equal
+// or larger
+int StringBPlusTree::compareKey(const StringNode* node, int i, string_view rest, uint32_t head) {
+    uint32_t keyHead = node->heads()[i];
+    if (head != keyHead) return head < keyHead ? -1 : 1;
+    return rest.compare(node->suffix(i));
+}
+
+// Index of the first key >= key, or > key if upper is set (numKeys if there is none)
+int StringBPlusTree::search(const StringNode* node, string_view key, bool upper) {
+    // A key outside the node's prefix sorts before or after all of its keys
+    string_view prefix = node->prefix();
+    size_t common = min(prefix.size(), key.size());
+    int order = memcmp(key.data(), prefix.data(), common);
+    if (order < 0 || (order == 0 && key.size() < prefix.size())) return 0;
+    if (order > 0) return node->numKeys;
+
+    string_view rest = key.substr(prefix.size());
+    uint32_t head = StringNode::headOf(rest);
+    int low = 0;
+    int high = node->numKeys;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        int comparison = compareKey(node, middle, rest, head);
+        if (comparison > 0 || (upper && comparison == 0)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+bool StringBPlusTree::keyEquals(const StringNode* node, int i, string_view key) {
+    string_view prefix = node->prefix();
+    return key.size() == prefix.size() + node->refs()[i].length
+           && key.compare(0, prefix.size(), prefix) == 0
+           && key.substr(prefix.size()) == node->suffix(i);
+}
+
+// Follows the child to the right of every separator <= key down to a leaf,
+// recording each interior node and the child taken in steps if given
+StringNode* StringBPlusTree::findLeaf(string_view key, vector<PathStep>* steps) const {
+    StringNode* node = root;
+    while (!node->isLeaf) {
+        int i = search(node, key, true);
+        if (steps) {steps->push_back({node, i});}
+        node = node->children()[i];
+    }
+    return node;
+}
+
+// Inserts key into the key arrays at index, shrinking the node's prefix first
+// if key does not share it. The caller shifts the slots.
+void StringBPlusTree::insertKeyAt(StringNode* node, int index, string_view key) {
+    string_view prefix = node->prefix();
+    if (key.compare(0, prefix.size(), prefix) != 0) {
+        repack(node, commonPrefix(prefix, key));
+    }
+
+    string_view suffix = key.substr(node->prefixLength);
+    uint32_t* heads = node->heads();
+    StringNode::KeyRef* refs = node->refs();
+    move_backward(heads + index, heads + node->numKeys, heads + node->numKeys + 1);
+    move_backward(refs + index, refs + node->numKeys, refs + node->numKeys + 1);
+    heads[index] = StringNode::headOf(suffix);
+    refs[index] = {(uint32_t)node->heap.size(), (uint32_t)suffix.size()};
+    node->heap.append(suffix.data(), suffix.size());
+    node->numKeys++;
+}
+
+// Removes key index from the key arrays. The caller shifts the slots.
+void StringBPlusTree::eraseKeyAt(StringNode* node, int index) {
+    uint32_t* heads = node->heads();
+    StringNode::KeyRef* refs = node->refs();
+    node->garbage += refs[index].length;
+    move(heads + index + 1, heads + node->numKeys, heads + index);
+    move(refs + index + 1, refs + node->numKeys, refs + index);
+    node->numKeys--;
+
+    if (node->garbage >= kMinGarbage && node->garbage * 2 >= node->heap.size()) {
+        repack(node, node->prefixLength);
+    }
+}
+
+void StringBPlusTree::replaceKeyAt(StringNode* node, int index, string_view key) {
+    eraseKeyAt(node, index);
+    insertKeyAt(node, index, key);
+}
+
+// Rewrites the heap without the removed keys, keeping only the first
+// prefixLength bytes of the current prefix as the new prefix
+void StringBPlusTree::repack(StringNode* node, uint32_t prefixLength) {
+    string old;
+    old.swap(node->heap);
+    string_view moved(old.data() + prefixLength, node->prefixLength - prefixLength);
+
+    node->heap.reserve(old.size() - node->garbage + node->numKeys * moved.size());
+    node->heap.append(old.data(), prefixLength);
+    for (int i = 0; i < node->numKeys; i++) {
+        StringNode::KeyRef& ref = node->refs()[i];
+        uint32_t offset = node->heap.size();
+        node->heap.append(moved.data(), moved.size());
+        node->heap.append(old.data() + ref.offset, ref.length);
+        ref = {offset, (uint32_t)(ref.length + moved.size())};
+        node->heads()[i] = StringNode::headOf(node->suffix(i));
+    }
+    node->prefixLength = prefixLength;
+    node->garbage = 0;
+}
+
+// Replaces the node's keys with keys[first, last), compressed under their
+// longest common prefix. The slots are left to the caller.
+void StringBPlusTree::assignKeys(StringNode* node, const vector<string>& keys, size_t first, size_t last) {
+    // The keys are sorted, so the first and last share the longest prefix of all of them
+    uint32_t prefixLength = last > first ? commonPrefix(keys[first], keys[last - 1]) : 0;
+    node->heap.clear();
+    node->heap.append(last > first ? keys[first].data() : "", prefixLength);
+    node->prefixLength = prefixLength;
+    node->garbage = 0;
+    node->numKeys = last - first;
+    for (size_t k = first; k < last; k++) {
+        string_view suffix = string_view(keys[k]).substr(prefixLength);
+        node->heads()[k - first] = StringNode::headOf(suffix);
+        node->refs()[k - first] = {(uint32_t)node->heap.size(), (uint32_t)suffix.size()};
+        node->heap.append(suffix.data(), suffix.size());
+    }
+}
+
+vector<string> StringBPlusTree::keysOf(const StringNode* node) const {
+    vector<string> keys;
+    keys.reserve(node->numKeys + 1);
+    for (int i = 0; i < node->numKeys; i++) {
+        keys.push_back(node->key(i));
+    }
+    return keys;
+}
+
+bool StringBPlusTree::insert(string_view key, const string& value) {
+    // Start with an empty root leaf if the tree is empty
+    if (!root) {
+        root = newNode(true);
+    }
+
+    path.clear();
+    StringNode* leaf = findLeaf(key, &path);
+    int i = search(leaf, key, false);
+    if (i < leaf->numKeys && keyEquals(leaf, i, key)) return false;
+
+    // Open slot i for the value and place the key there
+    string* values = leaf->values();
+    move_backward(values + i, values + leaf->numKeys, values + leaf->numKeys + 1);
+    insertKeyAt(leaf, i, key);
+    values[i] = value;
+    numEntries++;
+
+    if (leaf->numKeys > maxKeys) {
+        splitLeaf(leaf);
+    }
+    return true;
+}
+
+void StringBPlusTree::splitLeaf(StringNode* leaf) {
+    vector<string> keys = keysOf(leaf);
+    int total = leaf->numKeys;
+    int minKeys = ceilDivide(maxKeys, 2);
+
+    // Of the split points that leave both halves legal, take the one with the
+    // shortest separator, preferring the middle on ties
+    int leftSize = total / 2;
+    size_t bestLength = shortestSeparator(keys[leftSize - 1], keys[leftSize]).size();
+    for (int size = minKeys; size <= total - minKeys; size++) {
+        size_t length = commonPrefix(keys[size - 1], keys[size]) + 1;
+        if (length < bestLength) {
+            bestLength = length;
+            leftSize = size;
+        }
+    }
+
+    // Move the upper keys and values to a new leaf
+    StringNode* newLeaf = newNode(true);
+    move(leaf->values() + leftSize, leaf->values() + total, newLeaf->values());
+    assignKeys(leaf, keys, 0, leftSize);
+    assignKeys(newLeaf, keys, leftSize, total);
+
+    // Redefine pointers
+    newLeaf->next = leaf->next;
+    leaf->next = newLeaf;
+
+    insertIntoParent(leaf, shortestSeparator(keys[leftSize - 1], keys[leftSize]), newLeaf);
+}
+
+void StringBPlusTree::splitInterior(StringNode* node) {
+    vector<string> keys = keysOf(node);
+    int total = node->numKeys;
+    int minKeys = maxKeys / 2;
+
+    // Promote the shortest key that leaves at least minKeys keys on each side
+    int middleIndex = total / 2;
+    for (int i = minKeys; i <= total - 1 - minKeys; i++) {
+        if (keys[i].size() < keys[middleIndex].size()) {middleIndex = i;}
+    }
+
+    // Move the keys and children after the middle key to a new node
+    StringNode* newInterior = newNode(false);
+    copy(node->children() + middleIndex + 1, node->children() + total + 1, newInterior->children());
+    assignKeys(node, keys, 0, middleIndex);
+    assignKeys(newInterior, keys, middleIndex + 1, total);
+
+    insertIntoParent(node, keys[middleIndex], newInterior);
+}
+
+// Adds separator and the new right node to the parent of left, the last node
+// on the path; a new root is made when left was the root
+void StringBPlusTree::insertIntoParent(StringNode* left, const string& separator, StringNode* right) {
+    if (path.empty()) {
+        root = newNode(false);
+        insertKeyAt(root, 0, separator);
+        root->children()[0] = left;
+        root->children()[1] = right;
+        return;
+    }
+
+    PathStep step = path.back();
+    path.pop_back();
+    StringNode* parent = step.node;
+    StringNode** children = parent->children();
+    move_backward(children + step.childIndex + 1, children + parent->numKeys + 1, children + parent->numKeys + 2);
+    insertKeyAt(parent, step.childIndex, separator);
+    children[step.childIndex + 1] = right;
+
+    if (parent->numKeys > maxKeys) {
+        splitInterior(parent);
+    }
+}
+
+bool StringBPlusTree::remove(string_view key) {
+    if (!root) return false;
+
+    path.clear();
+    StringNode* leaf = findLeaf(key, &path);
+    int i = search(leaf, key, false);
+    if (i == leaf->numKeys || !keyEquals(leaf, i, key)) return false;
+
+    // Delete the key and its value, releasing the value's memory
+    string* values = leaf->values();
+    move(values + i + 1, values + leaf->numKeys, values + i);
+    string().swap(values[leaf->numKeys - 1]);
+    eraseKeyAt(leaf, i);
+    numEntries--;
+
+    rebalance(leaf);
+    return true;
+}
+
+// Borrows for or merges an under-full node, the end of the recorded path, and
+// repeats for the parent after a merge
+void StringBPlusTree::rebalance(StringNode* node) {
+    // The root may hold any number of keys, but shrinks the tree once it has none
+    if (path.empty()) {
+        if (node->numKeys == 0) {
+            root = node->isLeaf ? nullptr : node->children()[0];
+            freeNode(node);
+        }
+        return;
+    }
+
+    int minKeys = node->isLeaf ? ceilDivide(maxKeys, 2) : maxKeys / 2;
+    if (node->numKeys >= minKeys) return;
+
+    PathStep step = path.back();
+    path.pop_back();
+    StringNode* parent = step.node;
+    int index = step.childIndex;
+    StringNode* leftSibling = index > 0 ? parent->children()[index - 1] : nullptr;
+    StringNode* rightSibling = index < parent->numKeys ? parent->children()[index + 1] : nullptr;
+
+    if (node->isLeaf) {
+        string* values = node->values();
+
+        // Borrow the left sibling's last entry, then separate the two leaves anew
+        if (leftSibling && leftSibling->numKeys > minKeys) {
+            int last = leftSibling->numKeys - 1;
+            string key = leftSibling->key(last);
+            move_backward(values, values + node->numKeys, values + node->numKeys + 1);
+            values[0] = move(leftSibling->values()[last]);
+            insertKeyAt(node, 0, key);
+            eraseKeyAt(leftSibling, last);
+            replaceKeyAt(parent, index - 1, shortestSeparator(leftSibling->key(last - 1), key));
+            return;
+        }
+
+        // Borrow the right sibling's first entry
+        if (rightSibling && rightSibling->numKeys > minKeys) {
+            string key = rightSibling->key(0);
+            string* siblingValues = rightSibling->values();
+            values[node->numKeys] = move(siblingValues[0]);
+            insertKeyAt(node, node->numKeys, key);
+            move(siblingValues + 1, siblingValues + rightSibling->numKeys, siblingValues);
+            eraseKeyAt(rightSibling, 0);
+            replaceKeyAt(parent, index, shortestSeparator(key, rightSibling->key(0)));
+            return;
+        }
+    } else {
+        StringNode** children = node->children();
+
+        // Rotate the left sibling's last child through the parent
+        if (leftSibling && leftSibling->numKeys > minKeys) {
+            int last = leftSibling->numKeys - 1;
+            move_backward(children, children + node->numKeys + 1, children + node->numKeys + 2);
+            children[0] = leftSibling->children()[last + 1];
+            insertKeyAt(node, 0, parent->key(index - 1));
+            replaceKeyAt(parent, index - 1, leftSibling->key(last));
+            eraseKeyAt(leftSibling, last);
+            return;
+        }
+
+        // Rotate the right sibling's first child through the parent
+        if (rightSibling && rightSibling->numKeys > minKeys) {
+            StringNode** siblingChildren = rightSibling->children();
+            children[node->numKeys + 1] = siblingChildren[0];
+            insertKeyAt(node, node->numKeys, parent->key(index));
+            replaceKeyAt(parent, index, rightSibling->key(0));
+            move(siblingChildren + 1, siblingChildren + rightSibling->numKeys + 1, siblingChildren);
+            eraseKeyAt(rightSibling, 0);
+            return;
+        }
+    }
+
+    // If borrowing is not possible, merge with a sibling: right into left
+    StringNode* left = leftSibling ? leftSibling : node;
+    StringNode* right = leftSibling ? node : rightSibling;
+    int separatorIndex = leftSibling ? index - 1 : index;
+
+    vector<string> keys = keysOf(left);
+    int leftCount = left->numKeys;
+    if (left->isLeaf) {
+        move(right->values(), right->values() + right->numKeys, left->values() + leftCount);
+        left->next = right->next;
+    } else {
+        // The separator comes down between the two sets of children
+        keys.push_back(parent->key(separatorIndex));
+        copy(right->children(), right->children() + right->numKeys + 1, left->children() + leftCount + 1);
+    }
+    for (int i = 0; i < right->numKeys; i++) {
+        keys.push_back(right->key(i));
+    }
+    assignKeys(left, keys, 0, keys.size());
+    freeNode(right);
+
+    // Remove the separator and the pointer to the right node from the parent
+    StringNode** parentChildren = parent->children();
+    move(parentChildren + separatorIndex + 2, parentChildren + parent->numKeys + 1, parentChildren + separatorIndex + 1);
+    eraseKeyAt(parent, separatorIndex);
+
+    rebalance(parent);
+}
+
+const string& StringBPlusTree::find(string_view key) const {
+    static const string kMissing = "<empty>";
+    const string* value = get(key);
+    return value ? *value : kMissing;
+}
+
+const string* StringBPlusTree::get(string_view key) const {
+    if (!root) return nullptr;
+
+    StringNode* leaf = findLeaf(key, nullptr);
+    int i = search(leaf, key, false);
+    if (i < leaf->numKeys && keyEquals(leaf, i, key)) {
+        return &leaf->values()[i];
+    }
+    return nullptr;
+}
+
+StringBPlusTree::Iterator::Iterator(StringNode* leaf, int index) : leaf(leaf), index(index) {
+    // Step over the end of a leaf onto the first key of the next one
+    while (this->leaf && this->index >= this->leaf->numKeys) {
+        this->leaf = this->leaf->next;
+        this->index = 0;
+    }
+}
+
+StringBPlusTree::Iterator& StringBPlusTree::Iterator::operator++() {
+    *this = Iterator(leaf, index + 1);
+    return *this;
+}
+
+StringBPlusTree::Iterator StringBPlusTree::begin() const {
+    if (!root) return end();
+
+    // Go down to the first leaf node (leftmost)
+    StringNode* node = root;
+    while (!node->isLeaf) {
+        node = node->children()[0];
+    }
+    return Iterator(node, 0);
+}
+
+StringBPlusTree::Iterator StringBPlusTree::end() const {
+    return Iterator(nullptr, 0);
+}
+
+StringBPlusTree::Iterator StringBPlusTree::lowerBound(string_view key) const {
+    if (!root) return end();
+    StringNode* leaf = findLeaf(key, nullptr);
+    return Iterator(leaf, search(leaf, key, false));
+}
+
+StringBPlusTree::Iterator StringBPlusTree::upperBound(string_view key) const {
+    if (!root) return end();
+    StringNode* leaf = findLeaf(key, nullptr);
+    return Iterator(leaf, search(leaf, key, true));
+}
+
+void StringBPlusTree::printKeys() {
+    if (!root) {
+        cout << "The tree is empty." << endl;
+        return;
+    }
+
+    // Visit the nodes a level at a time
+    queue<StringNode*> nodesToVisit;
+    nodesToVisit.push(root);
+
+    while (!nodesToVisit.empty()) {
+        int currentLevelSize = nodesToVisit.size();
+        for (int i = 0; i < currentLevelSize; i++) {
+            StringNode* currentNode = nodesToVisit.front();
+            nodesToVisit.pop();
+
+            cout << "[";
+            for (int j = 0; j < currentNode->numKeys; j++) {
+                cout << currentNode->key(j);
+                if (j != currentNode->numKeys - 1) {cout << " ";}
+            }
+            cout << "]";
+
+            if (!currentNode->isLeaf) {
+                for (int j = 0; j <= currentNode->numKeys; j++) {
+                    nodesToVisit.push(currentNode->children()[j]);
+                }
+            }
+
+            if (i != currentLevelSize - 1) {cout << " ";}
+        }
+        cout << endl;
+    }
+}
+
+void StringBPlusTree::printValues() {
+    for (Iterator it = begin(); it != end(); ++it) {
+        cout << it.value() << endl;
+    }
+}
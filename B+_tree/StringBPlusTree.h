@@ -0,0 +1,172 @@
+#ifndef STRING_BPLUSTREE_H
+#define STRING_BPLUSTREE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "BPlusTree.h"
+
+using namespace std;
+
+// A node of a StringBPlusTree. Like Node it is one cache-line-aligned block:
+// this header, then `capacity` key heads, then `capacity` key references, then
+// the slots (capacity + 1 child pointers for interior nodes, capacity values
+// stored inline for leaves). The key bytes are not in the block but in the
+// node's heap, a separately allocated string that can grow with the keys:
+// first the prefix every key in the node shares, then the rest of each key.
+//
+// A key's head is the first 4 bytes after the prefix, big-endian and
+// zero-padded, so comparing heads as integers orders keys by those bytes. Most
+// comparisons during a search are settled by the heads alone; the heap is only
+// read when two heads are equal.
+class StringNode {
+public:
+    struct KeyRef {
+        uint32_t offset;  // Where the key's suffix starts in the heap
+        uint32_t length;
+    };
+
+    int numKeys;
+    int capacity;
+    bool isLeaf;
+    uint32_t prefixLength;  // Bytes at the start of the heap shared by every key
+    uint32_t garbage;       // Heap bytes of removed keys, reclaimed once they reach half the heap
+    string heap;            // Key bytes, allocated apart from the block
+    StringNode* next;  // Used for leaves to point to the next leaf
+
+    StringNode(bool isLeaf, int capacity);
+    ~StringNode();
+
+    uint32_t* heads() {return reinterpret_cast<uint32_t*>(this + 1);}
+    const uint32_t* heads() const {return reinterpret_cast<const uint32_t*>(this + 1);}
+    KeyRef* refs() {return reinterpret_cast<KeyRef*>(heads() + capacity);}
+    const KeyRef* refs() const {return reinterpret_cast<const KeyRef*>(heads() + capacity);}
+    StringNode** children() {return reinterpret_cast<StringNode**>(slots());}
+    StringNode* const* children() const {return reinterpret_cast<StringNode* const*>(slots());}
+    string* values() {return reinterpret_cast<string*>(slots());}
+    const string* values() const {return reinterpret_cast<const string*>(slots());}
+
+    string_view prefix() const {return string_view(heap.data(), prefixLength);}
+    string_view suffix(int i) const {return string_view(heap.data() + refs()[i].offset, refs()[i].length);}
+    string key(int i) const;  // The whole key: prefix and suffix
+
+    // Head of the bytes in suffix
+    static uint32_t headOf(string_view suffix);
+    // Bytes needed for a node of the given kind and capacity
+    static size_t blockSize(bool isLeaf, int capacity);
+
+private:
+    static size_t slotOffset(int capacity);
+    char* slots() {return reinterpret_cast<char*>(this) + slotOffset(capacity);}
+    const char* slots() const {return reinterpret_cast<const char*>(this) + slotOffset(capacity);}
+};
+
+// B+ tree with variable-length string keys, kept in byte order so range scans
+// work on keys such as URLs and composite IDs. Each node stores its keys
+// prefix-compressed in its own heap. Separators are suffix-truncated: a leaf
+// split promotes the shortest string that separates the two halves rather
+// than a whole key, and both kinds of split pick the split point, among those
+// that leave both halves legal, with the shortest separator.
+//
+// Nodes have no parent pointers; inserts and removes record the path taken
+// from the root and walk back up it.
+class StringBPlusTree {
+private:
+    struct PathStep {
+        StringNode* node;
+        int childIndex;
+    };
+
+    StringNode* root;
+    int maxKeys;
+    size_t numEntries;
+    NodeArena leafArena;
+    NodeArena interiorArena;
+    vector<PathStep> path;  // Scratch path for insert and remove
+
+    StringNode* newNode(bool isLeaf);
+    void freeNode(StringNode* node);
+    void destroyTree(StringNode* node);
+    StringNode* copyNodes(const StringNode* fromNode, StringNode*& previousLeaf);
+
+    static int compareKey(const StringNode* node, int i, string_view rest, uint32_t head);
+    static int search(const StringNode* node, string_view key, bool upper);
+    static bool keyEquals(const StringNode* node, int i, string_view key);
+    StringNode* findLeaf(string_view key, vector<PathStep>* steps) const;
+
+    void insertKeyAt(StringNode* node, int index, string_view key);
+    void eraseKeyAt(StringNode* node, int index);
+    void replaceKeyAt(StringNode* node, int index, string_view key);
+    void repack(StringNode* node, uint32_t prefixLength);
+    void assignKeys(StringNode* node, const vector<string>& keys, size_t first, size_t last);
+    vector<string> keysOf(const StringNode* node) const;
+
+    void splitLeaf(StringNode* leaf);
+    void splitInterior(StringNode* node);
+    void insertIntoParent(StringNode* left, const string& separator, StringNode* right);
+    void rebalance(StringNode* node);
+
+public:
+    StringBPlusTree(int maxKeys);
+    ~StringBPlusTree();
+
+    bool insert(string_view key, const string& value);  // Returns false if the key already exists
+    bool remove(string_view key);
+    // Returns the value, or "<empty>" if the key is missing. The reference is
+    // valid until the tree is next changed.
+    const string& find(string_view key) const;
+    const string* get(string_view key) const;  // nullptr if the key is missing
+    size_t size() const {return numEntries;}
+
+    void printKeys();
+    void printValues();
+
+    // Forward iterator over the leaf chain in key order. Keys are rebuilt from
+    // their prefix and suffix; an iterator is invalidated by any insert or remove.
+    class Iterator {
+    public:
+        string key() const {return leaf->key(index);}
+        const string& value() const {return leaf->values()[index];}
+        Iterator& operator++();
+        bool operator==(const Iterator& other) const {return leaf == other.leaf && index == other.index;}
+        bool operator!=(const Iterator& other) const {return !(*this == other);}
+
+    private:
+        StringNode* leaf;  // nullptr once past the last key
+        int index;
+
+        Iterator(StringNode* leaf, int index);
+        friend class StringBPlusTree;
+    };
+
+    Iterator begin() const;
+    Iterator end() const;
+    Iterator lowerBound(string_view key) const;  // First key >= key
+    Iterator upperBound(string_view key) const;  // First key > key
+
+    // Calls callback(key, value) for every key in [lo, hi], in order
+    template <typename Callback>
+    void scan(string_view lo, string_view hi, Callback callback) const {
+        Iterator it = lowerBound(lo);
+        string key;
+        for (StringNode* leaf = it.leaf; leaf; leaf = leaf->next) {
+            string_view prefix = leaf->prefix();
+            for (int i = (leaf == it.leaf ? it.index : 0); i < leaf->numKeys; i++) {
+                key.assign(prefix.data(), prefix.size());
+                key.append(leaf->suffix(i).data(), leaf->suffix(i).size());
+                if (string_view(key) > hi) return;
+                callback(static_cast<const string&>(key), static_cast<const string&>(leaf->values()[i]));
+            }
+        }
+    }
+
+    // Copy constructor and assignment operator
+    StringBPlusTree(const StringBPlusTree& other);
+    StringBPlusTree& operator=(const StringBPlusTree& other);
+    // Moving hands over the nodes without copying; the source is left empty
+    StringBPlusTree(StringBPlusTree&& other) noexcept;
+    StringBPlusTree& operator=(StringBPlusTree&& other) noexcept;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Runs a batch of independent tasks on several threads. The tasks are dealt
+// out round-robin to one deque per worker; a worker takes tasks from the back
+// of its own deque and, once that is empty, steals from the front of the
+// others', so a worker that drew the large tasks does not hold up the rest.
+class TaskPool {
+public:
+    typedef function<void(int)> Task;  // Called with the index of the worker running it
+
+    TaskPool(int threads) : threads(max(1, threads)) {}
+    int size() const {return threads;}
+
+    // Runs every task, with the calling thread as worker 0, and returns once
+    // they have all finished
+    void run(vector<Task>& tasks) {
+        int workers = (int)min<size_t>(threads, tasks.size());
+        if (workers == 0) return;
+        vector<WorkQueue> queues(workers);
+        for (size_t i = 0; i < tasks.size(); i++) {
+            queues[i % workers].tasks.push_back(&tasks[i]);
+        }
+
+        vector<thread> helpers;
+        for (int worker = 1; worker < workers; worker++) {
+            helpers.emplace_back(work, ref(queues), worker);
+        }
+        work(queues, 0);
+        for (thread& helper : helpers) {
+            helper.join();
+        }
+    }
+
+private:
+    struct WorkQueue {
+        mutex lock;
+        deque<Task*> tasks;
+    };
+
+    int threads;
+
+    static Task* take(WorkQueue& queue, bool fromBack) {
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.tasks.empty()) return nullptr;
+        Task* task;
+        if (fromBack) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        } else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        return task;
+    }
+
+    // No task adds others, so a worker is done once every deque is empty
+    static void work(vector<WorkQueue>& queues, int self) {
+        int count = queues.size();
+        while (true) {
+            Task* task = take(queues[self], true);
+            for (int i = 1; !task && i < count; i++) {
+                task = take(queues[(self + i) % count], false);
+            }
+            if (!task) return;
+            (*task)(self);
+        }
+    }
+};
+
+#endif
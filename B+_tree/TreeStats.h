@@ -0,0 +1,174 @@
+#ifndef TREE_STATS_H
+#define TREE_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Build with -DBPLUSTREE_STATS=0 to compile the counters out, and with
+// -DBPLUSTREE_LATENCY=1 to time every insert, find and remove.
+#ifndef BPLUSTREE_STATS
+#define BPLUSTREE_STATS 1
+#endif
+#ifndef BPLUSTREE_LATENCY
+#define BPLUSTREE_LATENCY 0
+#endif
+
+constexpr bool kTreeStatsEnabled = BPLUSTREE_STATS;
+constexpr bool kTreeLatencyEnabled = BPLUSTREE_LATENCY;
+
+// A counter written by the tree's thread and readable from any other. With a
+// single writer, a relaxed load and store is enough and costs no more than a
+// plain increment; readers may see a slightly stale value.
+class StatCounter {
+public:
+    StatCounter() : value(0) {}
+    StatCounter(const StatCounter& other) : value(other.get()) {}
+    StatCounter& operator=(const StatCounter& other) {
+        value.store(other.get(), memory_order_relaxed);
+        return *this;
+    }
+
+    void add(int64_t amount = 1) {
+        if (kTreeStatsEnabled) {
+            value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+        }
+    }
+    uint64_t get() const {return value.load(memory_order_relaxed);}
+    void reset() {value.store(0, memory_order_relaxed);}
+
+private:
+    atomic<uint64_t> value;
+};
+
+// Event counts and node counts, kept up to date as the tree changes. Copying
+// takes a snapshot, which is safe from any thread.
+struct TreeCounters {
+    StatCounter inserts;
+    StatCounter finds;
+    StatCounter removes;
+    StatCounter leafSplits;
+    StatCounter interiorSplits;
+    StatCounter leafMerges;
+    StatCounter interiorMerges;
+    StatCounter borrows;         // Keys or children moved from a sibling to refill a node
+    StatCounter nodesVisited;    // Nodes searched on the way to a leaf, leaf included
+    StatCounter keyComparisons;  // Key comparisons made by those searches
+    StatCounter leafNodes;
+    StatCounter interiorNodes;
+};
+
+// Latency histogram with HDR-style buckets: exact below 16ns, then 16 linear
+// sub-buckets per power of two, so every recorded value is within 1/16 of its
+// bucket's lower bound. Written by one thread, readable from any.
+class LatencyHistogram {
+public:
+    static const int kSubBuckets = 16;
+    static const int kBuckets = 61 * kSubBuckets;
+
+    LatencyHistogram() {reset();}
+
+    void record(uint64_t nanoseconds) {
+        atomic<uint64_t>& bucket = buckets[bucketFor(nanoseconds)];
+        bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        total.store(total.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        if (nanoseconds > maximum.load(memory_order_relaxed)) {
+            maximum.store(nanoseconds, memory_order_relaxed);
+        }
+    }
+
+    uint64_t count() const {return total.load(memory_order_relaxed);}
+    uint64_t max() const {return maximum.load(memory_order_relaxed);}
+
+    // Smallest bucket bound that at least fraction of the samples fall under,
+    // capped at the largest sample so it never reports more than max()
+    uint64_t percentile(double fraction) const {
+        uint64_t samples = count();
+        if (samples == 0) return 0;
+        uint64_t target = (uint64_t)(fraction * samples + 0.5);
+        if (target == 0) {target = 1;}
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += buckets[i].load(memory_order_relaxed);
+            if (seen >= target) return min(bucketUpperBound(i), max());
+        }
+        return max();
+    }
+
+    void reset() {
+        for (atomic<uint64_t>& bucket : buckets) {
+            bucket.store(0, memory_order_relaxed);
+        }
+        total.store(0, memory_order_relaxed);
+        maximum.store(0, memory_order_relaxed);
+    }
+
+private:
+    atomic<uint64_t> buckets[kBuckets];
+    atomic<uint64_t> total;
+    atomic<uint64_t> maximum;
+
+    static int bucketFor(uint64_t value) {
+        if (value < kSubBuckets) return (int)value;
+        int exponent = 63 - __builtin_clzll(value);  // At least 4
+        int subBucket = (int)((value >> (exponent - 4)) & (kSubBuckets - 1));
+        return (exponent - 3) * kSubBuckets + subBucket;
+    }
+
+    static uint64_t bucketUpperBound(int index) {
+        if (index < kSubBuckets) return index;
+        int exponent = index / kSubBuckets + 3;
+        uint64_t subBucket = index % kSubBuckets;
+        return ((kSubBuckets + subBucket + 1) << (exponent - 4)) - 1;
+    }
+};
+
+struct TreeLatency {
+    LatencyHistogram insert;
+    LatencyHistogram find;
+    LatencyHistogram remove;
+};
+
+// Times the enclosing scope into one of a TreeLatency's histograms. Compiles
+// to nothing unless BPLUSTREE_LATENCY is set; latency may be null.
+class LatencyTimer {
+public:
+    LatencyTimer(TreeLatency* latency, LatencyHistogram TreeLatency::* histogram)
+        : latency(latency), histogram(histogram) {
+        if (kTreeLatencyEnabled && latency) {start = chrono::steady_clock::now();}
+    }
+    ~LatencyTimer() {
+        if (kTreeLatencyEnabled && latency) {
+            auto elapsed = chrono::steady_clock::now() - start;
+            (latency->*histogram).record(chrono::duration_cast<chrono::nanoseconds>(elapsed).count());
+        }
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+private:
+    TreeLatency* latency;
+    LatencyHistogram TreeLatency::* histogram;
+    chrono::steady_clock::time_point start;
+};
+
+// The shape of a tree, computed by walking it
+struct TreeStats {
+    int height = 0;                 // Levels, counting the leaves; 0 when empty
+    size_t numKeys = 0;
+    size_t leafNodes = 0;
+    size_t interiorNodes = 0;
+    vector<size_t> levelNodes;  // Root level first
+    vector<double> levelFill;   // Average keys per node over maxKeys, root level first
+    double leafFill = 0.0;
+    size_t pendingCompaction = 0;
+    TreeCounters counters;
+};
+
+#endif
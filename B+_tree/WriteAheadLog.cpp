@@ -0,0 +1,242 @@
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "WriteAheadLog.h"
+
+using namespace std;
+
+namespace {
+
+// Every record: body length, checksum of the type and body, type, then the body
+const size_t kRecordHeader = sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint8_t);
+
+// FNV-1a, continuing from hash
+uint32_t checksum(const char* bytes, size_t length, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+bool writeAll(int fd, const char* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) return false;
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+}  // namespace
+
+// Log initialization
+WriteAheadLog::WriteAheadLog(const string& path, const WalOptions& options)
+    : options(options), pendingOps(0), operationCount(0), failed(false), stopFlusher(false) {
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw runtime_error("WriteAheadLog: cannot open " + path);
+    }
+    if (options.syncInterval.count() > 0) {
+        flusher = thread(&WriteAheadLog::flusherLoop, this);
+    }
+}
+
+// Log deletion
+WriteAheadLog::~WriteAheadLog() {
+    if (flusher.joinable()) {
+        {
+            lock_guard<mutex> lock(logMutex);
+            stopFlusher = true;
+        }
+        wakeFlusher.notify_one();
+        flusher.join();
+    }
+    try {
+        sync();
+    } catch (const exception&) {
+        // Nothing useful can be done about a failed write while closing
+    }
+    close(fd);
+}
+
+WriteAheadLog::Recovery WriteAheadLog::recover() {
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        throw runtime_error("WriteAheadLog: cannot read the log");
+    }
+    string log(fileStat.st_size, '\0');
+    size_t bytesRead = 0;
+    while (bytesRead < log.size()) {
+        ssize_t n = pread(fd, &log[bytesRead], log.size() - bytesRead, bytesRead);
+        if (n <= 0) break;
+        bytesRead += n;
+    }
+    log.resize(bytesRead);
+
+    vector<Record> operations;
+    vector<Record> pendingImages;
+    Recovery recovery;
+    uint64_t covered = 0;
+    size_t offset = 0;
+    while (offset + kRecordHeader <= log.size()) {
+        uint32_t length;
+        uint32_t expected;
+        memcpy(&length, &log[offset], sizeof(length));
+        memcpy(&expected, &log[offset + sizeof(length)], sizeof(expected));
+        if (length > log.size() - offset - kRecordHeader) break;
+        const char* typeAndBody = &log[offset + 2 * sizeof(uint32_t)];
+        if (checksum(typeAndBody, length + 1) != expected) break;
+
+        Record record;
+        record.type = (RecordType)typeAndBody[0];
+        record.key = 0;
+        record.pageId = 0;
+        const char* body = typeAndBody + 1;
+        bool valid = true;
+        switch (record.type) {
+            case kInsert:
+            case kRemove:
+                valid = length >= sizeof(int32_t) && (record.type == kInsert || length == sizeof(int32_t));
+                if (!valid) break;
+                memcpy(&record.key, body, sizeof(int32_t));
+                record.payload.assign(body + sizeof(int32_t), length - sizeof(int32_t));
+                operations.push_back(move(record));
+                break;
+            case kPageImage:
+                valid = length > sizeof(uint32_t);
+                if (!valid) break;
+                memcpy(&record.pageId, body, sizeof(uint32_t));
+                record.payload.assign(body + sizeof(uint32_t), length - sizeof(uint32_t));
+                pendingImages.push_back(move(record));
+                break;
+            case kCheckpointEnd:
+                valid = length == sizeof(uint64_t);
+                if (!valid) break;
+                memcpy(&covered, body, sizeof(uint64_t));
+                recovery.pageImages = move(pendingImages);
+                pendingImages.clear();
+                break;
+            default:
+                valid = false;
+        }
+        if (!valid) break;
+        offset += kRecordHeader + length;
+    }
+
+    // Anything past the last good record was torn by a crash
+    if (ftruncate(fd, offset) != 0) {
+        throw runtime_error("WriteAheadLog: cannot truncate the log");
+    }
+
+    lock_guard<mutex> lock(logMutex);
+    operationCount = operations.size();
+    recovery.firstOperation = min<uint64_t>(covered, operations.size());
+    recovery.operations.assign(make_move_iterator(operations.begin() + recovery.firstOperation),
+                               make_move_iterator(operations.end()));
+    return recovery;
+}
+
+void WriteAheadLog::logInsert(int key, const string& value) {
+    int32_t body = key;
+    append(kInsert, reinterpret_cast<const char*>(&body), sizeof(body), value.data(), value.size());
+}
+
+void WriteAheadLog::logRemove(int key) {
+    int32_t body = key;
+    append(kRemove, reinterpret_cast<const char*>(&body), sizeof(body), nullptr, 0);
+}
+
+void WriteAheadLog::logPageImage(uint32_t pageId, const char* page, size_t pageSize) {
+    append(kPageImage, reinterpret_cast<const char*>(&pageId), sizeof(pageId), page, pageSize);
+}
+
+void WriteAheadLog::logCheckpointEnd(uint64_t coveredOperations) {
+    append(kCheckpointEnd, reinterpret_cast<const char*>(&coveredOperations), sizeof(coveredOperations), nullptr, 0);
+}
+
+uint64_t WriteAheadLog::operationsLogged() const {
+    lock_guard<mutex> lock(logMutex);
+    return operationCount;
+}
+
+void WriteAheadLog::append(RecordType type, const char* body, size_t length, const char* extra, size_t extraLength) {
+    uint32_t bodyLength = length + extraLength;
+    uint8_t typeByte = type;
+    uint32_t sum = checksum(reinterpret_cast<const char*>(&typeByte), 1);
+    sum = checksum(body, length, sum);
+    sum = checksum(extra, extraLength, sum);
+
+    unique_lock<mutex> lock(logMutex);
+    if (failed) {
+        throw runtime_error("WriteAheadLog: an earlier write failed");
+    }
+    buffer.append(reinterpret_cast<const char*>(&bodyLength), sizeof(bodyLength));
+    buffer.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+    buffer.push_back(typeByte);
+    buffer.append(body, length);
+    buffer.append(extra, extraLength);
+
+    if (type == kInsert || type == kRemove) {
+        operationCount++;
+        if (++pendingOps >= options.syncEveryOps) {
+            syncLocked(lock);
+        }
+    }
+}
+
+void WriteAheadLog::sync() {
+    unique_lock<mutex> lock(logMutex);
+    syncLocked(lock);
+}
+
+// Writes and syncs the buffered records. Appends can continue while the fsync
+// runs; the next group is written once this one is done.
+void WriteAheadLog::syncLocked(unique_lock<mutex>& lock) {
+    if (failed) {
+        throw runtime_error("WriteAheadLog: an earlier write failed");
+    }
+    unique_lock<mutex> io(ioMutex);
+    string group;
+    group.swap(buffer);
+    pendingOps = 0;
+    lock.unlock();
+
+    bool written = group.empty() || (writeAll(fd, group.data(), group.size()) && fdatasync(fd) == 0);
+
+    io.unlock();
+    lock.lock();
+    if (!written) {
+        failed = true;
+        throw runtime_error("WriteAheadLog: failed to write the log");
+    }
+}
+
+void WriteAheadLog::reset() {
+    lock_guard<mutex> lock(logMutex);
+    lock_guard<mutex> io(ioMutex);
+    buffer.clear();
+    pendingOps = 0;
+    operationCount = 0;
+    if (ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) {
+        failed = true;
+        throw runtime_error("WriteAheadLog: cannot truncate the log");
+    }
+}
+
+void WriteAheadLog::flusherLoop() {
+    unique_lock<mutex> lock(logMutex);
+    while (!stopFlusher) {
+        wakeFlusher.wait_for(lock, options.syncInterval);
+        if (buffer.empty() || failed) continue;
+        try {
+            syncLocked(lock);
+        } catch (const exception&) {
+            // failed is set; the next append reports it
+        }
+    }
+}
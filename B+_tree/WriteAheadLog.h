@@ -0,0 +1,88 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+using namespace std;
+
+struct WalOptions {
+    size_t syncEveryOps = 128;                  // Group commit: fsync once this many operations are pending...
+    chrono::milliseconds syncInterval{20};      // ...or this long after the last fsync (0 disables the timer)
+    size_t checkpointEveryOps = 100000;         // Bounds how much of the log recovery has to replay
+};
+
+// Append-only redo log. Operations are encoded into a memory buffer and made
+// durable in groups: one write and fsync covers every operation appended since
+// the previous one. Checkpoints append the images of the pages they are about
+// to write, then an end record, so a checkpoint torn by a crash can be finished
+// from the log. Every record carries a length and checksum; recovery stops at
+// the first one that does not check out.
+class WriteAheadLog {
+public:
+    enum RecordType : uint8_t {
+        kInsert = 1,
+        kRemove = 2,
+        kPageImage = 3,
+        kCheckpointEnd = 4,
+    };
+
+    struct Record {
+        RecordType type;
+        int32_t key;
+        uint32_t pageId;
+        string payload;  // Inserted value or page image
+    };
+
+    // What recover() found: the page images of the last complete checkpoint,
+    // and the operations that checkpoint does not cover, in log order
+    struct Recovery {
+        vector<Record> pageImages;
+        vector<Record> operations;
+        uint64_t firstOperation = 0;  // Position of operations[0] among all operations in the log
+        bool empty() const {return pageImages.empty() && operations.empty();}
+    };
+
+    // Throws runtime_error if the log cannot be opened
+    WriteAheadLog(const string& path, const WalOptions& options);
+    ~WriteAheadLog();  // Syncs anything still pending
+
+    Recovery recover();  // Call once before logging; drops a torn tail
+
+    void logInsert(int key, const string& value);
+    void logRemove(int key);
+    void logPageImage(uint32_t pageId, const char* page, size_t pageSize);
+    void logCheckpointEnd(uint64_t coveredOperations);
+    void sync();   // Makes everything logged so far durable
+    void reset();  // Empties the log once a checkpoint is on disk
+    uint64_t operationsLogged() const;
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+private:
+    int fd;
+    WalOptions options;
+    string buffer;             // Encoded records not yet written
+    size_t pendingOps;         // Operations in buffer
+    uint64_t operationCount;   // Operations in the log file, synced or not
+    bool failed;
+
+    mutable mutex logMutex;    // Guards the buffer and counters
+    mutex ioMutex;             // Keeps group commits in order; taken after logMutex
+    condition_variable wakeFlusher;
+    bool stopFlusher;
+    thread flusher;            // Runs group commits on the timer
+
+    void append(RecordType type, const char* body, size_t length, const char* extra, size_t extraLength);
+    void syncLocked(unique_lock<mutex>& lock);
+    void flusherLoop();
+};
+
+#endif
@@ -0,0 +1,117 @@
+// Multi-threaded throughput benchmark: ConcurrentBPlusTree against a BPlusTree
+// behind one global mutex, for 1 to N threads and several read/insert/remove mixes.
+//   g++ -O2 -std=c++17 -pthread concurrentBench.cpp ConcurrentBPlusTree.cpp BPlusTree.cpp -o concurrentBench
+//   ./concurrentBench [maxThreads] [opsPerThread] [maxKeys]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include "BPlusTree.h"
+#include "ConcurrentBPlusTree.h"
+
+using namespace std;
+
+struct Mix {
+    const char* name;
+    int readPercent;
+    int insertPercent;  // The rest are removes
+};
+
+const int kKeyRange = 1 << 20;
+
+// Runs opsPerThread operations on every thread and returns millions of operations per second
+template <typename Tree>
+double runMix(Tree& tree, const Mix& mix, int numThreads, int opsPerThread) {
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&tree, &mix, opsPerThread, t]() {
+            mt19937 rng(t * 7919 + 1);
+            uniform_int_distribution<int> keys(0, kKeyRange - 1);
+            uniform_int_distribution<int> percent(0, 99);
+            string value = "value";
+            for (int i = 0; i < opsPerThread; i++) {
+                int key = keys(rng);
+                int roll = percent(rng);
+                if (roll < mix.readPercent) {
+                    tree.find(key);
+                } else if (roll < mix.readPercent + mix.insertPercent) {
+                    tree.insert(key, value);
+                } else {
+                    tree.remove(key);
+                }
+            }
+        });
+    }
+    for (thread& t : threads) {t.join();}
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return numThreads * (double)opsPerThread / seconds / 1e6;
+}
+
+// The pattern being replaced: the single-threaded tree behind a global mutex
+class LockedBPlusTree {
+public:
+    LockedBPlusTree(int maxKeys) : tree(maxKeys) {}
+    string find(int key) {lock_guard<mutex> lock(treeMutex); return tree.find(key);}
+    bool insert(int key, const string& value) {lock_guard<mutex> lock(treeMutex); return tree.insert(key, value);}
+    bool remove(int key) {lock_guard<mutex> lock(treeMutex); return tree.remove(key);}
+
+private:
+    BPlusTree tree;
+    mutex treeMutex;
+};
+
+template <typename Tree>
+void preload(Tree& tree) {
+    // Every other key, so reads hit about half the time
+    for (int key = 0; key < kKeyRange; key += 2) {
+        tree.insert(key, "value");
+    }
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : max(1u, thread::hardware_concurrency());
+    int opsPerThread = argc > 2 ? atoi(argv[2]) : 200000;
+    int maxKeys = argc > 3 ? atoi(argv[3]) : 64;
+
+    vector<Mix> mixes = {
+        {"read-only", 100, 0},
+        {"read-mostly", 90, 5},
+        {"balanced", 50, 25},
+        {"write-heavy", 10, 45},
+    };
+
+    // Powers of two up to maxThreads, then maxThreads itself
+    vector<int> threadCounts;
+    for (int numThreads = 1; numThreads < maxThreads; numThreads *= 2) {
+        threadCounts.push_back(numThreads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    cout << "maxKeys " << maxKeys << ", " << opsPerThread << " ops per thread (Mops/s)" << endl;
+    cout << setw(12) << "mix" << setw(9) << "threads" << setw(12) << "olc" << setw(12) << "mutex" << endl;
+
+    for (const Mix& mix : mixes) {
+        for (int numThreads : threadCounts) {
+            ConcurrentBPlusTree concurrentTree(maxKeys);
+            LockedBPlusTree lockedTree(maxKeys);
+            preload(concurrentTree);
+            preload(lockedTree);
+
+            double concurrent = runMix(concurrentTree, mix, numThreads, opsPerThread);
+            double locked = runMix(lockedTree, mix, numThreads, opsPerThread);
+
+            cout << fixed << setprecision(2)
+                 << setw(12) << mix.name
+                 << setw(9) << numThreads
+                 << setw(12) << concurrent
+                 << setw(12) << locked << endl;
+        }
+    }
+}
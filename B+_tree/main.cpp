@@ -1,15 +1,28 @@
 #include <iostream>
 #include <vector>
+#include <cstdio>
 #include "BPlusTree.h"
+#include "BasicBPlusTree.h"
+#include "StringBPlusTree.h"
+#include "DiskBPlusTree.h"
 
 using namespace std;
 
 // Function Prototypes
 void simpleTest();
+void templatedTest();
+void stringTest();
+void diskTest();
 
 int main() {
     simpleTest();
     cout << endl;
+    templatedTest();
+    cout << endl;
+    stringTest();
+    cout << endl;
+    diskTest();
+    cout << endl;
 }
 
 void simpleTest()
@@ -35,11 +48,249 @@ void simpleTest()
     cout << endl << "CHECK" << endl;
     cout << "one" << endl << "three" << endl << "five" << endl << "nine" << endl;
 
+    // Iterators and range scans
+    cout << endl;
+    for (auto it = bp1.lowerBound(2); it != bp1.end(); ++it) {
+        cout << it.key() << " ";
+    }
+    cout << endl;
+    bp1.scan(3, 5, [](int key, const string& value) {
+        cout << key << ":" << value << " ";
+    });
+    cout << endl << "CHECK" << endl;
+    cout << "3 5 9 " << endl;
+    cout << "3:three 5:five " << endl;
+
+    // Batched insert and lookup
+    cout << endl;
+    BPlusTree bp4(4);
+    size_t inserted = bp4.insertBatch({{8, "eight"}, {2, "two"}, {6, "six"}, {2, "again"}, {4, "four"}});
+    cout << "inserted: " << inserted << " (4)" << endl;
+    for (const string& value : bp4.findBatch({2, 4, 5, 8})) {
+        cout << value << " ";
+    }
+    cout << endl << "CHECK" << endl;
+    cout << "two four <empty> eight " << endl;
+
+    // Values moved in or constructed in place
+    cout << endl;
+    BPlusTree bp6(4);
+    string longValue(100, 'x');
+    bp6.insert(1, move(longValue));
+    bp6.emplace(2, 3, 'y');
+    const string* value = bp6.get(2);
+    cout << "get 2: " << (value ? *value : "nullptr") << " (yyy)" << endl;
+    cout << "get 3: " << (bp6.get(3) ? "found" : "nullptr") << " (nullptr)" << endl;
+    BPlusTree bp7(move(bp6));
+    cout << "find 1 after move: " << bp7.find(1).size() << " (100)" << endl;
+
+    // Lazy deletion and incremental compaction
+    cout << endl;
+    BPlusTree bp8(4);
+    bp8.setLazyDeletion(true);
+    for (int i = 1; i <= 12; i++) {
+        bp8.insert(i, to_string(i));
+    }
+    for (int i = 1; i <= 8; i++) {
+        bp8.remove(i);
+    }
+    bp8.printKeys();
+    while (bp8.compact(1) > 0) {}
+    bp8.printKeys();
+    cout << endl << "CHECK" << endl;
+    cout << "[10]" << endl;
+    cout << "[9] [10 11 12]" << endl;
+    cout << "[11]" << endl;
+    cout << "[9 10] [11 12]" << endl;
+
+    // Shape and counters
+    cout << endl;
+    TreeStats stats = bp8.stats();
+    cout << "height: " << stats.height << " (2)" << endl;
+    cout << "leaf nodes: " << stats.leafNodes << " (2)" << endl;
+    cout << "leaf fill: " << stats.leafFill << " (0.5)" << endl;
+    cout << "inserts counted: " << bp8.counters().inserts.get() << " (12)" << endl;
+
+    // Copy-on-write snapshots
+    cout << endl;
+    BPlusTree::Snapshot before = bp8.snapshot();
+    bp8.remove(9);
+    bp8.insert(20, "20");
+    cout << "find 9 in snapshot: " << before.find(9) << " (9)" << endl;
+    cout << "find 9 in tree: " << bp8.find(9) << " (<empty>)" << endl;
+    before.scan(0, 100, [](int key, const string&) {
+        cout << key << " ";
+    });
+    cout << endl << "CHECK" << endl;
+    cout << "9 10 11 12 " << endl;
+
+    // Order statistics and aggregates
+    cout << endl;
+    cout << "rank 5: " << bp1.rank(5) << " (2)" << endl;
+    cout << "count [2, 9]: " << bp1.countRange(2, 9) << " (3)" << endl;
+    cout << "select 3: " << bp1.select(3).key() << " (9)" << endl;
+    TreeAggregate valueLength;
+    valueLength.measure = [](int, const string& value) {return (long long)value.size();};
+    valueLength.combine = [](long long a, long long b) {return a + b;};
+    bp1.setAggregate(valueLength);
+    cout << "value length in [1, 5]: " << bp1.aggregate(1, 5) << " (12)" << endl;
+
+    // Multimap mode
+    cout << endl;
+    BPlusTree bp10(4);
+    bp10.setMultimap(true);
+    bp10.insert(7, "a");
+    bp10.insertBatch({{3, "x"}, {7, "b"}, {7, "c"}});
+    for (string_view value : bp10.findAll(7)) {
+        cout << value << " ";
+    }
+    cout << endl << "size: " << bp10.size() << " (2)" << endl;
+    cout << "CHECK" << endl;
+    cout << "a b c " << endl;
+
+    // Snapshot files
+    cout << endl;
+    bp1.save("simpleTest.snapshot");
+    BPlusTree bp5(16);
+    cout << "load: " << bp5.load("simpleTest.snapshot") << " (1)" << endl;
+    cout << "find 9: " << bp5.find(9) << " (nine)" << endl;
+    BPlusTree bp11(4);
+    bp11.setLazyDeletion(true);
+    for (int i = 0; i < 20; i++) {
+        bp11.insert(i, to_string(i));
+    }
+    for (int i = 0; i < 20; i++) {
+        if (i % 4 != 0) {bp11.remove(i);}
+    }
+    bp11.save("lazyTest.snapshot");
+    cout << "load after lazy deletion: " << bp5.load("lazyTest.snapshot") << " (1)" << endl;
+    cout << "size: " << bp5.size() << " (5)" << endl;
+    bp10.save("multimapTest.snapshot");
+    cout << "load multimap: " << bp5.load("multimapTest.snapshot") << " (1)" << endl;
+    bp5.insert(7, "d");
+    for (string_view value : bp5.findAll(7)) {
+        cout << value << " ";
+    }
+    cout << endl << "CHECK" << endl;
+    cout << "a b c d " << endl;
+    bp1.save("simpleTest.snapshot");
+    bp10.load("simpleTest.snapshot");
+    cout << "multimap after loading a plain snapshot: " << bp10.isMultimap() << " (0)" << endl;
+
     // Copy constructor and op=
     BPlusTree bp2(bp1);
     BPlusTree bp3(7);
     bp3.insert(13, "thirteen");
     bp3 = bp1;
 
+    // Parallel copy, and destroying in the background
+    BPlusTree bp9(bp1, 2);
+    cout << "find 5 in parallel copy: " << bp9.find(5) << " (five)" << endl;
+    future<void> cleared = bp9.clearInBackground();
+    cleared.wait();
+    cout << "find 5 after clear: " << bp9.find(5) << " (<empty>)" << endl;
+
+    std::remove("simpleTest.snapshot");
+    std::remove("lazyTest.snapshot");
+    std::remove("multimapTest.snapshot");
+
     cout << endl << "simple test complete" << endl;
-}
\ No newline at end of file
+}
+
+struct Record {
+    long long id;
+    double score;
+};
+
+void templatedTest()
+{
+    // 64-bit keys with fixed-size records stored inline
+    BasicBPlusTree<long long, Record, less<long long>, 4> bp;
+    for (long long i = 1; i <= 9; i++) {
+        bp.insert(i * 10000000000LL, {i, i * 0.5});
+    }
+    bp.remove(30000000000LL);
+
+    cout << "size: " << bp.size() << " (8)" << endl;
+    cout << "find 20000000000: " << bp.find(20000000000LL)->score << " (1)" << endl;
+    cout << "find 30000000000: " << (bp.find(30000000000LL) ? "found" : "<empty>") << " (<empty>)" << endl;
+    for (auto it = bp.lowerBound(60000000000LL); it != bp.end(); ++it) {
+        cout << it.value().id << " ";
+    }
+    cout << endl << "CHECK" << endl;
+    cout << "6 7 8 9 " << endl;
+
+    cout << endl << "templated test complete" << endl;
+}
+
+void stringTest()
+{
+    // Variable-length keys, scanned in byte order
+    StringBPlusTree bp(4);
+    bp.insert("https://example.com/b", "b");
+    bp.insert("https://example.com/a", "a");
+    bp.insert("https://example.com/a/1", "a1");
+    bp.insert("https://example.com/c", "c");
+    bp.insert("https://example.org/", "org");
+    bp.insert("http://example.com/", "http");
+    bp.remove("https://example.com/c");
+
+    cout << "size: " << bp.size() << " (5)" << endl;
+    cout << "find https://example.com/a/1: " << bp.find("https://example.com/a/1") << " (a1)" << endl;
+    cout << "find https://example.com/c: " << bp.find("https://example.com/c") << " (<empty>)" << endl;
+    bp.scan("https://example.com/", "https://example.com/~", [](const string& key, const string& value) {
+        cout << key << ":" << value << " ";
+    });
+    cout << endl << "CHECK" << endl;
+    cout << "https://example.com/a:a https://example.com/a/1:a1 https://example.com/b:b " << endl;
+
+    cout << endl << "string test complete" << endl;
+}
+
+void diskTest()
+{
+    const char* path = "diskTest.db";
+    std::remove(path);
+    std::remove("diskTest.db.wal");
+    {
+        DiskBPlusTree bp(path);
+        for (int i = 1; i <= 2000; i++) {
+            bp.insert(i, "value" + to_string(i));
+        }
+        bp.remove(1000);
+    }
+
+    {
+        // Reopening reads only the metadata page
+        DiskBPlusTree bp(path);
+        cout << "size: " << bp.size() << " (1999)" << endl;
+        cout << "find 1500: " << bp.find(1500) << " (value1500)" << endl;
+        cout << "find 1000: " << bp.find(1000) << " (<empty>)" << endl;
+        cout << "insert long value: " << bp.insert(3000, string(2000, 'x')) << " (0)" << endl;
+    }
+
+    // Recovery: crashed is never destroyed, so it never checkpoints and its
+    // changes are only in the log when the file is opened again
+    const char* crashPath = "crashTest.db";
+    std::remove(crashPath);
+    std::remove("crashTest.db.wal");
+    DiskBPlusTree* crashed = new DiskBPlusTree(crashPath);
+    for (int i = 1; i <= 500; i++) {
+        crashed->insert(i, "value" + to_string(i));
+    }
+    crashed->remove(250);
+    crashed->flush();
+    {
+        DiskBPlusTree recovered(crashPath);
+        cout << "size after recovery: " << recovered.size() << " (499)" << endl;
+        cout << "find 400: " << recovered.find(400) << " (value400)" << endl;
+        cout << "find 250: " << recovered.find(250) << " (<empty>)" << endl;
+    }
+
+    std::remove(path);
+    std::remove("diskTest.db.wal");
+    std::remove(crashPath);
+    std::remove("crashTest.db.wal");
+
+    cout << endl << "disk test complete" << endl;
+}
@@ -0,0 +1,85 @@
+// Microbenchmark for the node search kernel in NodeSearch.h against the linear
+// scans BPlusTree used before. Build with the same flags as the tree, e.g.
+//   g++ -O2 -march=native searchBench.cpp -o searchBench
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include "NodeSearch.h"
+
+using namespace std;
+
+// The scan BPlusTree::insertIntoLeaf used: index of the first key >= key
+int linearLowerBound(const int* keys, int n, int key) {
+    int i = 0;
+    while (i < n && key > keys[i]) {i++;}
+    return i;
+}
+
+// The scan BPlusTree::findLeaf used: index of the child to descend into
+int linearChildIndex(const int* keys, int n, int key) {
+    if (key < keys[0]) {return 0;}
+    for (int i = 1; i < n; i++) {
+        if (keys[i - 1] <= key && key < keys[i]) {return i;}
+    }
+    return n;
+}
+
+template <typename Search>
+double nanosPerSearch(Search search, const vector<int>& keys, const vector<int>& probes, long long& checksum) {
+    auto start = chrono::steady_clock::now();
+    for (int probe : probes) {
+        checksum += search(keys.data(), keys.size(), probe);
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / probes.size();
+}
+
+int main() {
+    mt19937 rng(12345);
+    const int numProbes = 2000000;
+    long long checksum = 0;
+
+    cout << "window: " << NodeSearch::kWindow << " keys" << endl;
+    cout << setw(8) << "keys"
+         << setw(14) << "linear lb"
+         << setw(14) << "kernel lb"
+         << setw(14) << "linear child"
+         << setw(14) << "kernel child" << "   (ns/search)" << endl;
+
+    for (int n : {4, 8, 16, 32, 64, 128, 256, 512}) {
+        // Sorted, distinct keys with gaps so that probes hit and miss
+        vector<int> keys(n);
+        for (int i = 0; i < n; i++) {keys[i] = i * 4;}
+
+        vector<int> probes(numProbes);
+        uniform_int_distribution<int> dist(-4, n * 4 + 4);
+        for (int& probe : probes) {probe = dist(rng);}
+
+        // Verify the kernel agrees with the scans before timing it
+        for (int i = 0; i < 10000; i++) {
+            int probe = probes[i];
+            if (NodeSearch::lowerBound(keys.data(), n, probe) != linearLowerBound(keys.data(), n, probe) ||
+                NodeSearch::upperBound(keys.data(), n, probe) != linearChildIndex(keys.data(), n, probe)) {
+                cout << "mismatch for " << n << " keys, probe " << probe << endl;
+                return 1;
+            }
+        }
+
+        double linearLb = nanosPerSearch(linearLowerBound, keys, probes, checksum);
+        double kernelLb = nanosPerSearch(NodeSearch::lowerBound, keys, probes, checksum);
+        double linearChild = nanosPerSearch(linearChildIndex, keys, probes, checksum);
+        double kernelChild = nanosPerSearch(NodeSearch::upperBound, keys, probes, checksum);
+
+        cout << fixed << setprecision(2)
+             << setw(8) << n
+             << setw(14) << linearLb
+             << setw(14) << kernelLb
+             << setw(14) << linearChild
+             << setw(14) << kernelChild << endl;
+    }
+
+    cout << "checksum: " << checksum << endl;
+}
@@ -0,0 +1,371 @@
+// Single-threaded benchmark suite for BPlusTree. For every fanout, key count and
+// key distribution it measures loading by insert, point lookups, range scans and
+// removes, then runs YCSB-style mixes on a tree loaded with random keys. Results
+// are written as JSON (stdout, or --out=FILE) so runs can be compared over time;
+// progress goes to stderr.
+//   g++ -O2 -std=c++17 -pthread treeBench.cpp BPlusTree.cpp -o treeBench
+//   ./treeBench [--fanouts=4,16,64,128,256,512] [--sizes=1000,10000,100000,1000000]
+//               [--distributions=sequential,reverse,uniform,zipfian]
+//               [--workloads=a,b,c,e] [--ops=200000] [--out=results.json]
+//
+// Sizes up to 1e8 work but need several GB at small fanouts. One operation in
+// kSampleEvery is timed on its own for the latency percentiles; throughput is
+// measured over the whole phase.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include "BPlusTree.h"
+
+using namespace std;
+
+const size_t kSampleEvery = 8;
+const int kScanLength = 100;
+const int kMaxYcsbScan = 100;
+const double kZipfianTheta = 0.99;
+const string kValue = "value123";
+
+// Keeps the compiler from dropping lookups whose results are unused
+volatile size_t sink;
+
+enum Distribution {kSequential, kReverse, kUniform, kZipfian};
+const char* const kDistributionNames[] = {"sequential", "reverse", "uniform", "zipfian"};
+
+// YCSB's Zipfian generator (Gray et al., "Quickly generating billion-record
+// synthetic databases"): ranks in [0, n), rank 0 the most popular
+class ZipfianGenerator {
+public:
+    ZipfianGenerator(uint64_t n, double theta) : n(n), theta(theta) {
+        double zeta2 = 0;
+        zetaN = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            zetaN += 1.0 / pow((double)i, theta);
+            if (i == 2) {zeta2 = zetaN;}
+        }
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetaN);
+    }
+
+    uint64_t next(mt19937_64& rng) {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetaN;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5, theta)) return n > 1 ? 1 : 0;
+        uint64_t rank = (uint64_t)(n * pow(eta * u - eta + 1.0, alpha));
+        return rank < n ? rank : n - 1;
+    }
+
+private:
+    uint64_t n;
+    double theta;
+    double zetaN;
+    double alpha;
+    double eta;
+};
+
+// Maps rank i of n to a key, and picks which ranks the operations touch
+class KeySpace {
+public:
+    KeySpace(Distribution distribution, uint64_t n, uint64_t seed)
+        : distribution(distribution), n(n), rng(seed) {
+        if (distribution == kZipfian) {zipfian.reset(new ZipfianGenerator(n, kZipfianTheta));}
+    }
+
+    // Sequential and reverse keys are dense; random keys are a bijective
+    // scramble of the rank over [0, 2^31), so they are distinct and unordered
+    int key(uint64_t rank) const {
+        if (distribution == kSequential || distribution == kReverse) return (int)rank;
+        return (int)((rank * 2654435761ull) & 0x7fffffffu);
+    }
+
+    // The i-th key loaded: keys in order, in reverse, or scrambled
+    int loadKey(uint64_t i) const {
+        return key(distribution == kReverse ? n - 1 - i : i);
+    }
+
+    // The key of the i-th lookup: walking the keys in order or in reverse, or
+    // drawn uniformly, or by Zipfian popularity
+    int accessKey(uint64_t i) {
+        switch (distribution) {
+            case kSequential: return key(i % n);
+            case kReverse: return key(n - 1 - i % n);
+            case kUniform: return key(uniform_int_distribution<uint64_t>(0, n - 1)(rng));
+            default: return key(zipfian->next(rng));
+        }
+    }
+
+    // A key that is not loaded, for YCSB-E inserts
+    int freshKey(uint64_t i) const {return key(n + i);}
+
+    mt19937_64& random() {return rng;}
+
+private:
+    Distribution distribution;
+    uint64_t n;
+    mt19937_64 rng;
+    unique_ptr<ZipfianGenerator> zipfian;
+};
+
+struct PhaseResult {
+    size_t ops = 0;
+    uint64_t nanoseconds = 0;
+    LatencyHistogram latency;
+};
+
+// Runs op(i) for i in [0, count), timing every kSampleEvery-th call on its own
+template <typename Op>
+void runPhase(PhaseResult& result, size_t count, Op op) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        if (i % kSampleEvery == 0) {
+            auto before = chrono::steady_clock::now();
+            op(i);
+            result.latency.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - before).count());
+        } else {
+            op(i);
+        }
+    }
+    result.nanoseconds = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    result.ops = count;
+}
+
+string latencyJson(const LatencyHistogram& latency) {
+    ostringstream out;
+    out << "{\"samples\": " << latency.count()
+        << ", \"p50_ns\": " << latency.percentile(0.50)
+        << ", \"p99_ns\": " << latency.percentile(0.99)
+        << ", \"max_ns\": " << latency.max() << "}";
+    return out.str();
+}
+
+string resultJson(const string& phase, int fanout, uint64_t keys, const char* distribution,
+                  size_t ops, uint64_t nanoseconds, const string& extra) {
+    ostringstream out;
+    out << fixed << setprecision(4)
+        << "{\"phase\": \"" << phase << "\", \"fanout\": " << fanout << ", \"keys\": " << keys
+        << ", \"distribution\": \"" << distribution << "\", \"ops\": " << ops
+        << ", \"elapsed_ns\": " << nanoseconds
+        << ", \"mops_per_sec\": " << (nanoseconds > 0 ? ops * 1e3 / nanoseconds : 0.0)
+        << extra << "}";
+    return out.str();
+}
+
+void benchmarkDistribution(vector<string>& results, int fanout, uint64_t n, Distribution distribution, size_t ops) {
+    const char* name = kDistributionNames[distribution];
+    KeySpace space(distribution, n, fanout * 1000003ull + n);
+    BPlusTree tree(fanout);
+
+    // Load every key by insert, in the distribution's order
+    PhaseResult load;
+    runPhase(load, n, [&](size_t i) {tree.insert(space.loadKey(i), kValue);});
+    TreeStats shape = tree.stats();
+    ostringstream loadExtra;
+    loadExtra << fixed << setprecision(4)
+              << ", \"height\": " << shape.height << ", \"leaf_fill\": " << shape.leafFill
+              << ", \"latency\": " << latencyJson(load.latency);
+    results.push_back(resultJson("insert", fanout, n, name, load.ops, load.nanoseconds, loadExtra.str()));
+
+    PhaseResult lookup;
+    size_t found = 0;
+    runPhase(lookup, ops, [&](size_t i) {found += tree.get(space.accessKey(i)) != nullptr;});
+    sink = found;
+    results.push_back(resultJson("lookup", fanout, n, name, lookup.ops, lookup.nanoseconds,
+                                 ", \"latency\": " + latencyJson(lookup.latency)));
+
+    // Scans of kScanLength keys from the lookup keys
+    PhaseResult scan;
+    size_t scanned = 0;
+    runPhase(scan, max<size_t>(1, ops / 10), [&](size_t i) {
+        int count = 0;
+        for (auto it = tree.lowerBound(space.accessKey(i)); it != tree.end() && count < kScanLength; ++it, count++) {
+            scanned += it.value().size();
+        }
+    });
+    sink = scanned;
+    results.push_back(resultJson("scan", fanout, n, name, scan.ops, scan.nanoseconds,
+                                 ", \"scan_length\": " + to_string(kScanLength) + ", \"latency\": " + latencyJson(scan.latency)));
+
+    // Remove keys in the order they were loaded
+    PhaseResult removal;
+    runPhase(removal, min<uint64_t>(ops, n), [&](size_t i) {tree.remove(space.loadKey(i));});
+    results.push_back(resultJson("remove", fanout, n, name, removal.ops, removal.nanoseconds,
+                                 ", \"latency\": " + latencyJson(removal.latency)));
+}
+
+// YCSB core workloads on a tree of n random keys, with Zipfian requests.
+// The tree has no in-place update, so an update removes and reinserts the key.
+struct Workload {
+    char name;
+    int readPercent;
+    int updatePercent;
+    int scanPercent;
+    int insertPercent;
+};
+
+const Workload kWorkloads[] = {
+    {'a', 50, 50, 0, 0},
+    {'b', 95, 5, 0, 0},
+    {'c', 100, 0, 0, 0},
+    {'e', 0, 0, 95, 5},
+};
+
+void benchmarkWorkload(vector<string>& results, int fanout, uint64_t n, const Workload& workload, size_t ops) {
+    KeySpace space(kZipfian, n, fanout * 7919ull + n + workload.name);
+    BPlusTree tree(fanout);
+    for (uint64_t i = 0; i < n; i++) {
+        tree.insert(space.loadKey(i), kValue);
+    }
+
+    // Draw the operations up front so the random numbers are not timed
+    vector<int> kinds(ops);
+    vector<int> keys(ops);
+    vector<int> scanLengths(ops);
+    uniform_int_distribution<int> percent(0, 99);
+    uniform_int_distribution<int> scanLength(1, kMaxYcsbScan);
+    uint64_t inserted = 0;
+    for (size_t i = 0; i < ops; i++) {
+        int roll = percent(space.random());
+        int kind = roll < workload.readPercent ? 0
+                   : roll < workload.readPercent + workload.updatePercent ? 1
+                   : roll < workload.readPercent + workload.updatePercent + workload.scanPercent ? 2 : 3;
+        kinds[i] = kind;
+        keys[i] = kind == 3 ? space.freshKey(inserted++) : space.accessKey(i);
+        scanLengths[i] = scanLength(space.random());
+    }
+
+    const char* const kindNames[] = {"read", "update", "scan", "insert"};
+    LatencyHistogram latencies[4];
+    size_t checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        bool sampled = i % kSampleEvery == 0;
+        chrono::steady_clock::time_point before;
+        if (sampled) {before = chrono::steady_clock::now();}
+
+        switch (kinds[i]) {
+            case 0:
+                checksum += tree.get(keys[i]) != nullptr;
+                break;
+            case 1:
+                tree.remove(keys[i]);
+                tree.insert(keys[i], kValue);
+                break;
+            case 2: {
+                int count = 0;
+                for (auto it = tree.lowerBound(keys[i]); it != tree.end() && count < scanLengths[i]; ++it, count++) {
+                    checksum += it.value().size();
+                }
+                break;
+            }
+            default:
+                tree.insert(keys[i], kValue);
+        }
+
+        if (sampled) {
+            latencies[kinds[i]].record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - before).count());
+        }
+    }
+    uint64_t nanoseconds = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    sink = checksum;
+
+    string extra = ", \"latency\": {";
+    bool first = true;
+    for (int kind = 0; kind < 4; kind++) {
+        if (latencies[kind].count() == 0) continue;
+        extra += (first ? "\"" : ", \"") + string(kindNames[kind]) + "\": " + latencyJson(latencies[kind]);
+        first = false;
+    }
+    extra += "}";
+    results.push_back(resultJson(string("ycsb-") + workload.name, fanout, n, "zipfian", ops, nanoseconds, extra));
+}
+
+vector<string> splitList(const string& list) {
+    vector<string> items;
+    stringstream stream(list);
+    string item;
+    while (getline(stream, item, ',')) {
+        if (!item.empty()) {items.push_back(item);}
+    }
+    return items;
+}
+
+int main(int argc, char** argv) {
+    vector<int> fanouts = {4, 16, 64, 128, 256, 512};
+    vector<uint64_t> sizes = {1000, 10000, 100000, 1000000};
+    vector<Distribution> distributions = {kSequential, kReverse, kUniform, kZipfian};
+    string workloads = "abce";
+    size_t ops = 200000;
+    string outPath;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        size_t equals = arg.find('=');
+        string flag = arg.substr(0, equals);
+        string value = equals == string::npos ? "" : arg.substr(equals + 1);
+        if (flag == "--fanouts") {
+            fanouts.clear();
+            for (const string& item : splitList(value)) {fanouts.push_back(max(3, atoi(item.c_str())));}
+        } else if (flag == "--sizes") {
+            sizes.clear();
+            for (const string& item : splitList(value)) {sizes.push_back(max(1.0, atof(item.c_str())));}
+        } else if (flag == "--distributions") {
+            distributions.clear();
+            for (const string& item : splitList(value)) {
+                for (int d = 0; d < 4; d++) {
+                    if (item == kDistributionNames[d]) {distributions.push_back((Distribution)d);}
+                }
+            }
+        } else if (flag == "--workloads") {
+            workloads.clear();
+            for (const string& item : splitList(value)) {workloads += item;}
+        } else if (flag == "--ops") {
+            ops = max(1.0, atof(value.c_str()));
+        } else if (flag == "--out") {
+            outPath = value;
+        } else {
+            cerr << "unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    vector<string> results;
+    for (int fanout : fanouts) {
+        for (uint64_t n : sizes) {
+            for (Distribution distribution : distributions) {
+                cerr << "fanout " << fanout << ", " << n << " keys, " << kDistributionNames[distribution] << endl;
+                benchmarkDistribution(results, fanout, n, distribution, ops);
+            }
+            for (const Workload& workload : kWorkloads) {
+                if (workloads.find(workload.name) == string::npos) continue;
+                cerr << "fanout " << fanout << ", " << n << " keys, ycsb-" << workload.name << endl;
+                benchmarkWorkload(results, fanout, n, workload, ops);
+            }
+        }
+    }
+
+    ofstream file;
+    if (!outPath.empty()) {
+        file.open(outPath);
+        if (!file) {
+            cerr << "cannot write " << outPath << endl;
+            return 1;
+        }
+    }
+    ostream& out = outPath.empty() ? cout : file;
+    out << "{\"benchmark\": \"treeBench\", \"value_bytes\": " << kValue.size()
+        << ", \"sample_every\": " << kSampleEvery << ", \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        out << "  " << results[i] << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "]}" << endl;
+    return 0;
+}
@@ -0,0 +1,418 @@
+#include "ConcurrentSkipList.h"
+#include <new>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// every thread claims one slot index, used by all reclaimers
+atomic<bool> slotTaken[SkipListEpochReclaimer::kMaxThreads];
+
+struct ThreadSlot {
+    int index;
+
+    ThreadSlot() : index(-1) {
+        while(index < 0) {
+            for(int i = 0; i < SkipListEpochReclaimer::kMaxThreads && index < 0; i++) {
+                bool expected = false;
+                if(slotTaken[i].compare_exchange_strong(expected, true)) {
+                    index = i;
+                }
+            }
+            if(index < 0) {
+                this_thread::yield();
+            }
+        }
+    }
+
+    ~ThreadSlot() {
+        slotTaken[index].store(false);
+    }
+};
+
+int threadSlot() {
+    thread_local ThreadSlot slot;
+    return slot.index;
+}
+
+// keeps the calling thread inside an epoch until the end of the scope
+class EpochGuard {
+    public:
+	EpochGuard(SkipListEpochReclaimer& reclaimer) : reclaimer(reclaimer) {reclaimer.enter();}
+	~EpochGuard() {reclaimer.exit();}
+
+    private:
+	SkipListEpochReclaimer& reclaimer;
+};
+
+const uintptr_t kMarked = 1;
+const size_t kCollectInterval = 64;
+
+inline bool isMarked(uintptr_t link) {
+    return (link & kMarked) != 0;
+}
+
+}
+
+SkipListEpochReclaimer::SkipListEpochReclaimer() : globalEpoch(1) {
+    for(Slot& slot : slots) {
+        slot.epoch.store(0);
+    }
+}
+
+// only safe once no thread is using the reclaimer.
+SkipListEpochReclaimer::~SkipListEpochReclaimer() {
+    for(Slot& slot : slots) {
+        for(Retired& item : slot.retired) {
+            item.deleter(item.pointer);
+        }
+    }
+}
+
+void SkipListEpochReclaimer::enter() {
+    slots[threadSlot()].epoch.store(globalEpoch.load());
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void SkipListEpochReclaimer::exit() {
+    slots[threadSlot()].epoch.store(0, memory_order_release);
+}
+
+// items stay on the retiring thread's list; a thread that later takes over
+// the slot inherits whatever is left on it.
+void SkipListEpochReclaimer::retire(void* pointer, void (*deleter)(void*)) {
+    vector<Retired>& retired = slots[threadSlot()].retired;
+    retired.push_back({pointer, deleter, globalEpoch.load()});
+    if(retired.size() % kCollectInterval == 0) {
+        collect(retired);
+    }
+}
+
+// frees the items on the list retired before the oldest epoch a thread is still in.
+void SkipListEpochReclaimer::collect(vector<Retired>& retired) {
+    globalEpoch.fetch_add(1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    uint64_t oldestActive = globalEpoch.load();
+    for(Slot& slot : slots) {
+        uint64_t epoch = slot.epoch.load();
+        if(epoch != 0 && epoch < oldestActive) {
+            oldestActive = epoch;
+        }
+    }
+
+    size_t kept = 0;
+    for(Retired& item : retired) {
+        if(item.epoch < oldestActive) {
+            item.deleter(item.pointer);
+        }
+        else {
+            retired[kept++] = item;
+        }
+    }
+    retired.resize(kept);
+}
+
+
+ConcurrentSkipList::ConcurrentSkipList(int maxHeight) :
+    maxHeight(maxHeight < 1 ? 1 : (maxHeight > kMaxHeight ? kMaxHeight : maxHeight)),
+    height(1) {
+    head = newEntry("", NULL, this->maxHeight);
+    for(int level = 0; level < this->maxHeight; level++) {
+        head->next()[level].store(0);
+    }
+}
+
+// only safe once no other thread is using the list.
+ConcurrentSkipList::~ConcurrentSkipList() {
+    Entry* current = head;
+    while(current != NULL) {
+        Entry* next = reinterpret_cast<Entry*>(current->next()[0].load() & ~kMarked);
+        delete current->value.load();
+        freeEntry(current);
+        current = next;
+    }
+}
+
+ConcurrentSkipList::Entry* ConcurrentSkipList::newEntry(const Key& k, const Value* v, int height) {
+    void* block = ::operator new(sizeof(Entry) + height * sizeof(atomic<uintptr_t>));
+    Entry* entry = new (block) Entry(k, v, height);
+    for(int level = 0; level < height; level++) {
+        new (&entry->next()[level]) atomic<uintptr_t>(0);
+    }
+    return entry;
+}
+
+void ConcurrentSkipList::freeEntry(void* pointer) {
+    Entry* entry = static_cast<Entry*>(pointer);
+    entry->~Entry();
+    ::operator delete(pointer);
+}
+
+void ConcurrentSkipList::freeValue(void* value) {
+    delete static_cast<const Value*>(value);
+}
+
+// flips coins from a per-thread xorshift generator: an entry is on each list
+// above the lowest with probability 1/2.
+int ConcurrentSkipList::randomHeight() const {
+    thread_local uint64_t state = 0x9E3779B97F4A7C15ull ^ (uint64_t)hash<thread::id>()(this_thread::get_id());
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    uint64_t bits = state;
+    int h = 1;
+    while(h < maxHeight && (bits & 1)) {
+        h++;
+        bits >>= 1;
+    }
+    return h;
+}
+
+// fills preds and succs with the last entry before k and the one after it on
+// each list, unlinking every marked entry it passes. Lists above height are
+// taken to be empty, trailed by head and NULL, as in SkipList; an entry being
+// linked onto them raises height first, and a CAS against a stale trail fails.
+// Returns true if succs[0] holds k.
+bool ConcurrentSkipList::findWithTrail(std::string_view k, Entry** preds, Entry** succs) {
+retry:
+    int top = height.load();
+    for(int level = top; level < maxHeight; level++) {
+        preds[level] = head;
+        succs[level] = NULL;
+    }
+
+    Entry* pred = head;
+    for(int level = top - 1; level >= 0; level--) {
+        Entry* current = reinterpret_cast<Entry*>(pred->next()[level].load() & ~kMarked);
+        while(current != NULL) {
+            uintptr_t link = current->next()[level].load();
+            if(isMarked(link)) {
+                // fails if pred has changed or is being removed itself
+                uintptr_t expected = reinterpret_cast<uintptr_t>(current);
+                if(!pred->next()[level].compare_exchange_strong(expected, link & ~kMarked)) {
+                    goto retry;
+                }
+                current = reinterpret_cast<Entry*>(link & ~kMarked);
+            }
+            else if(current->key < k) {
+                pred = current;
+                current = reinterpret_cast<Entry*>(link);
+            }
+            else {
+                break;
+            }
+        }
+        preds[level] = pred;
+        succs[level] = current;
+    }
+    return succs[0] != NULL && succs[0]->key == k;
+}
+
+// marks every next pointer of the entry, the lowest last, so that nothing can be
+// linked after it. Idempotent, so any thread can help a remove along.
+void ConcurrentSkipList::markAll(Entry* entry) {
+    for(int level = entry->height - 1; level >= 0; level--) {
+        entry->next()[level].fetch_or(kMarked);
+    }
+}
+
+// the list and the inserter each give up the entry once they are done with it;
+// the last one hands it to the reclaimer.
+void ConcurrentSkipList::release(Entry* entry) {
+    if(entry->owners.fetch_sub(1) == 1) {
+        reclaimer.retire(entry, freeEntry);
+    }
+}
+
+bool ConcurrentSkipList::insert(const Key& k, const Value& v) {
+    EpochGuard guard(reclaimer);
+    Entry* preds[kMaxHeight];
+    Entry* succs[kMaxHeight];
+    const Value* value = new Value(v);
+    Entry* entry = NULL;
+
+    while(true) {
+        if(findWithTrail(k, preds, succs)) {
+            Entry* found = succs[0];
+            const Value* old = found->value.load();
+            if(old == NULL) {
+                // found is being removed: finish marking it so the next search unlinks it
+                markAll(found);
+                continue;
+            }
+            if(found->value.compare_exchange_strong(old, value)) {
+                reclaimer.retire(const_cast<Value*>(old), freeValue);
+                if(entry != NULL) {
+                    freeEntry(entry);
+                }
+                return false;
+            }
+            continue;
+        }
+
+        if(entry == NULL) {
+            entry = newEntry(k, value, randomHeight());
+        }
+        for(int level = 0; level < entry->height; level++) {
+            entry->next()[level].store(reinterpret_cast<uintptr_t>(succs[level]), memory_order_relaxed);
+        }
+        uintptr_t expected = reinterpret_cast<uintptr_t>(succs[0]);
+        if(preds[0]->next()[0].compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(entry))) {
+            break;
+        }
+    }
+
+    // k is in the map from here on; the other lists only speed up searches
+    int seen = height.load();
+    while(seen < entry->height && !height.compare_exchange_weak(seen, entry->height)) {}
+
+    for(int level = 1; level < entry->height; level++) {
+        while(true) {
+            // point the entry at the successor found by the last search, unless a
+            // remove has marked it; a stale successor may already be unlinked
+            uintptr_t successor = reinterpret_cast<uintptr_t>(succs[level]);
+            uintptr_t link = entry->next()[level].load();
+            if(isMarked(link) || (link != successor && !entry->next()[level].compare_exchange_strong(link, successor))) {
+                goto linked;
+            }
+            if(preds[level]->next()[level].compare_exchange_strong(successor, reinterpret_cast<uintptr_t>(entry))) {
+                break;
+            }
+            findWithTrail(k, preds, succs);
+            if(succs[0] != entry) {
+                goto linked;	// already removed and unlinked
+            }
+        }
+    }
+linked:
+
+    // a remove that ran while the lists were being linked may have missed one,
+    // so search again to unlink the entry everywhere before giving it up
+    if(isMarked(entry->next()[0].load())) {
+        findWithTrail(k, preds, succs);
+    }
+    release(entry);
+    return true;
+}
+
+bool ConcurrentSkipList::remove(std::string_view k) {
+    EpochGuard guard(reclaimer);
+    Entry* preds[kMaxHeight];
+    Entry* succs[kMaxHeight];
+    if(!findWithTrail(k, preds, succs)) {
+        return false;
+    }
+
+    // taking the value out is what removes k; only one remove can do it
+    Entry* found = succs[0];
+    const Value* old = found->value.load();
+    do {
+        if(old == NULL) {
+            return false;
+        }
+    } while(!found->value.compare_exchange_weak(old, NULL));
+    reclaimer.retire(const_cast<Value*>(old), freeValue);
+
+    markAll(found);
+    findWithTrail(k, preds, succs);
+    release(found);
+    return true;
+}
+
+// the first entry, removed or not, with a key greater than k (or equal to k, if
+// orEqual); NULL if there is none. Readers never unlink, so they step over
+// marked entries instead.
+ConcurrentSkipList::Entry* ConcurrentSkipList::firstAfter(std::string_view k, bool orEqual) const {
+    Entry* pred = head;
+    Entry* current = NULL;
+    for(int level = height.load(memory_order_acquire) - 1; level >= 0; level--) {
+        current = reinterpret_cast<Entry*>(pred->next()[level].load(memory_order_acquire) & ~kMarked);
+        while(current != NULL && (current->key < k || (!orEqual && current->key == k))) {
+            pred = current;
+            current = reinterpret_cast<Entry*>(current->next()[level].load(memory_order_acquire) & ~kMarked);
+        }
+    }
+    return current;
+}
+
+// the last entry, removed or not, with a key less than k (or equal to k, if
+// orEqual); head if there is none.
+ConcurrentSkipList::Entry* ConcurrentSkipList::lastBefore(std::string_view k, bool orEqual) const {
+    Entry* pred = head;
+    for(int level = height.load(memory_order_acquire) - 1; level >= 0; level--) {
+        Entry* current = reinterpret_cast<Entry*>(pred->next()[level].load(memory_order_acquire) & ~kMarked);
+        while(current != NULL && (current->key < k || (orEqual && current->key == k))) {
+            pred = current;
+            current = reinterpret_cast<Entry*>(current->next()[level].load(memory_order_acquire) & ~kMarked);
+        }
+    }
+    return pred;
+}
+
+// copies out the entry unless it has been removed.
+bool ConcurrentSkipList::copyOut(Entry* entry, Key& key, Value& value) {
+    const Value* current = entry->value.load(memory_order_acquire);
+    if(current == NULL) {
+        return false;
+    }
+    key = entry->key;
+    value = *current;
+    return true;
+}
+
+// the first entry still in the map after k; each removed one costs a step
+// forward, with no limit if writers keep removing the entries ahead.
+bool ConcurrentSkipList::firstLive(std::string_view k, bool orEqual, Key& key, Value& value) const {
+    EpochGuard guard(reclaimer);
+    for(Entry* entry = firstAfter(k, orEqual); entry != NULL;
+        entry = reinterpret_cast<Entry*>(entry->next()[0].load(memory_order_acquire) & ~kMarked)) {
+        if(copyOut(entry, key, value)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the last entry still in the map before k; with no back links, each removed
+// one costs another search from the top.
+bool ConcurrentSkipList::lastLive(std::string_view k, bool orEqual, Key& key, Value& value) const {
+    EpochGuard guard(reclaimer);
+    for(Entry* entry = lastBefore(k, orEqual); entry != head; entry = lastBefore(entry->key, false)) {
+        if(copyOut(entry, key, value)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ConcurrentSkipList::find(std::string_view k, Value& value) const {
+    EpochGuard guard(reclaimer);
+    for(Entry* entry = firstAfter(k, true); entry != NULL && entry->key == k;
+        entry = reinterpret_cast<Entry*>(entry->next()[0].load(memory_order_acquire) & ~kMarked)) {
+        const Value* current = entry->value.load(memory_order_acquire);
+        if(current != NULL) {
+            value = *current;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ConcurrentSkipList::ceilingEntry(std::string_view k, Key& key, Value& value) const {
+    return firstLive(k, true, key, value);
+}
+
+bool ConcurrentSkipList::floorEntry(std::string_view k, Key& key, Value& value) const {
+    return lastLive(k, true, key, value);
+}
+
+bool ConcurrentSkipList::greaterEntry(std::string_view k, Key& key, Value& value) const {
+    return firstLive(k, false, key, value);
+}
+
+bool ConcurrentSkipList::lesserEntry(std::string_view k, Key& key, Value& value) const {
+    return lastLive(k, false, key, value);
+}
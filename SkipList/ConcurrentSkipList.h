@@ -0,0 +1,114 @@
+#ifndef CONCURRENT_SKIPLIST_H
+#define CONCURRENT_SKIPLIST_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "SkipList.h"
+
+// Epoch-based reclamation. A thread enters an epoch before it touches any
+// entry and exits afterwards; memory handed to retire() is freed only once
+// every thread that entered before it was retired has exited. Each thread
+// keeps its own retire list and collects it itself, so retiring never waits
+// for another thread. SkipList stands alone, so this is its own copy of the
+// B+ tree's EpochReclaimer, named apart so that the two can be linked into one
+// program.
+class SkipListEpochReclaimer {
+    public:
+	static const int kMaxThreads = 256;
+
+	SkipListEpochReclaimer();
+	~SkipListEpochReclaimer();	// frees everything still waiting
+	void enter();
+	void exit();
+	void retire(void* pointer, void (*deleter)(void*));
+
+	SkipListEpochReclaimer(const SkipListEpochReclaimer&) = delete;
+	SkipListEpochReclaimer& operator=(const SkipListEpochReclaimer&) = delete;
+
+    private:
+	struct Retired {
+		void* pointer;
+		void (*deleter)(void*);
+		uint64_t epoch;
+	};
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> epoch;	// 0 while the thread is outside
+		std::vector<Retired> retired;	// only touched by the thread holding the slot
+	};
+
+	std::atomic<uint64_t> globalEpoch;
+	Slot slots[kMaxThreads];
+
+	void collect(std::vector<Retired>& retired);
+};
+
+// Lock-free ordered map with the same operations as SkipList, safe to call
+// from any number of threads. Each entry is one allocation holding its key,
+// its value and a next pointer per list, as in SkipList; the lowest bit of a
+// next pointer marks the entry as being removed.
+//
+// remove() takes the value out first, which is when the key stops being in
+// the map, then marks every next pointer so no entry can be linked after it,
+// then unlinks it. Writers that come across a marked entry unlink it too.
+// Readers never write and never restart: find() and the navigation calls
+// step over removed entries, moving through the keys in one direction only,
+// and copy out what they return. They are lock-free but not wait-free: a
+// reader always finishes unless writers keep inserting and removing keys just
+// ahead of it, and a floor or lesser lookup searches again from the top for
+// each removed entry it lands on. Entries and values are freed through a
+// SkipListEpochReclaimer once no reader can reach them.
+class ConcurrentSkipList {
+    public:
+	static const int kMaxHeight = 64;
+
+	ConcurrentSkipList(int maxHeight = 32);	// at most kMaxHeight
+	~ConcurrentSkipList();
+	ConcurrentSkipList(const ConcurrentSkipList&) = delete;
+	ConcurrentSkipList& operator=(const ConcurrentSkipList&) = delete;
+
+	// inserts k, or replaces its value; returns false if k was already there.
+	bool insert(const Key& k, const Value& v);
+	bool remove(std::string_view k);	// returns false if k was not there
+
+	// each returns false if there is no such entry, and otherwise copies it out.
+	bool find(std::string_view k, Value& value) const;
+	bool ceilingEntry(std::string_view k, Key& key, Value& value) const;
+	bool floorEntry(std::string_view k, Key& key, Value& value) const;
+	bool greaterEntry(std::string_view k, Key& key, Value& value) const;
+	bool lesserEntry(std::string_view k, Key& key, Value& value) const;
+
+    private:
+	struct Entry {
+		Key key;
+		std::atomic<const Value*> value;	// nullptr once removed
+		std::atomic<int> owners;	// the list, and the inserter until it has linked every list
+		int height;
+
+		Entry(const Key& k, const Value* v, int height) : key(k), value(v), owners(2), height(height) {}
+		std::atomic<uintptr_t>* next() {return reinterpret_cast<std::atomic<uintptr_t>*>(this + 1);}
+	};
+
+	Entry* head;	// on every list; its key is never compared
+	int maxHeight;
+	std::atomic<int> height;	// lists that may hold entries; only ever grows
+	mutable SkipListEpochReclaimer reclaimer;
+
+	static Entry* newEntry(const Key& k, const Value* v, int height);
+	static void freeEntry(void* entry);
+	static void freeValue(void* value);
+	int randomHeight() const;
+
+	bool findWithTrail(std::string_view k, Entry** preds, Entry** succs);
+	void markAll(Entry* entry);
+	void release(Entry* entry);
+	Entry* firstAfter(std::string_view k, bool orEqual) const;
+	Entry* lastBefore(std::string_view k, bool orEqual) const;
+	bool firstLive(std::string_view k, bool orEqual, Key& key, Value& value) const;
+	bool lastLive(std::string_view k, bool orEqual, Key& key, Value& value) const;
+	static bool copyOut(Entry* entry, Key& key, Value& value);
+};
+
+#endif
@@ -47,6 +47,13 @@ int main(int argc, char** argv) {
 	}
 	
 	map.print();
+	std::cout << std::endl;
+
+	std::cout << "keys in [A, M]:";
+	for(SkipList::Entry& entry : map.range("A", "M")) {
+		std::cout << " " << entry.getKey();
+	}
+	std::cout << std::endl;
 	return 0;
 }
 
@@ -1,109 +1,216 @@
 #include "SkipList.h"
 #include <iostream>
+#include <cstdlib>
+#include <new>
 
 using namespace std;
 
-SkipList::SkipList() : listHeads() {
-    makeNewLevelList();
-    makeNewLevelList();
+SkipList::SkipList(int maxHeight) :
+    maxHeight(maxHeight < 1 ? 1 : (maxHeight > kMaxHeight ? kMaxHeight : maxHeight)),
+    height(1) {
+    head = newEntry(Key(), Value(), this->maxHeight);
+    head->prev = head;
+    for(int level = 0; level < this->maxHeight; level++) {
+        head->next()[level] = NULL;
+    }
 }
 
-// makes a new list on the top level of existing list.
-// call only when top list is NULL or just the two sentinels. 
-void SkipList::makeNewLevelList() {
-    SkipList::Entry* minusInfinity = new Entry("!!", "");	// "!!" < any other string.
-    SkipList::Entry* plusInfinity = new Entry("}}", "");	// "}}" > any other key.
-
-    Quad* first = new Quad(minusInfinity);
-    Quad* last = new Quad(plusInfinity);
-
-    int numLists = listHeads.size();
-    Quad* oldFirst = numLists == 0 ? NULL : listHeads[numLists - 1];
-    Quad* oldLast  = numLists == 0 ? NULL : oldFirst->next;
+SkipList::~SkipList() {
+    Entry* current = head;
+    while(current != NULL) {
+        Entry* next = current->next()[0];
+        freeEntry(current);
+        current = next;
+    }
+}
 
-    first->prev = NULL;
-    first->next = last;
-    first->above = NULL;
-    first->below = oldFirst;
+// allocates the entry and its next pointers together; the pointers are left unset.
+SkipList::Entry* SkipList::newEntry(Key&& k, Value&& v, int height) {
+    void* block = ::operator new(sizeof(Entry) + height * sizeof(Entry*));
+    return new (block) Entry(std::move(k), std::move(v), height);
+}
 
-    last->prev = first;
-    last->next = NULL;
-    last->above = NULL;
-    last->below = oldLast;
+void SkipList::freeEntry(Entry* entry) {
+    entry->~Entry();
+    ::operator delete(entry);
+}
 
-    if(oldFirst != NULL) {
-        oldFirst->above = first;
-        oldLast->above = last;
+// flips coins: an entry is on each list above the lowest with probability 1/2.
+int SkipList::randomHeight() {
+    int h = 1;
+    while(h < maxHeight && rand() % 2 == 0) {
+        h++;
     }
-    listHeads.push_back(first);
+    return h;
 }
 
+// head and the end of the list are drawn as "!!" and "}}".
 void SkipList::printOneList(int listNum) {
-	Quad* bottomCurrent = listHeads[0];
-	Quad* current = listHeads[listNum];
-
-	while(bottomCurrent->next != NULL) {
+	cout << "--!!";
+	for(Entry* bottomCurrent = head->next()[0]; bottomCurrent != NULL; bottomCurrent = bottomCurrent->next()[0]) {
 		std::string toPrint;
-		if(current->entry->getKey() == bottomCurrent->entry->getKey()) {
-			toPrint = current->entry->getKey();
-			current = current->next;
+		if(bottomCurrent->height > listNum) {
+			toPrint = bottomCurrent->key;
 		}
 		else {
-			toPrint = "--";
+			toPrint = std::string(bottomCurrent->key.size(), '-');
 		}
 		cout << "--" << toPrint;
-		bottomCurrent = bottomCurrent->next;
 	}
-	cout << "--" << bottomCurrent->entry->getKey() << "--" << endl;
+	cout << "--}}--" << endl;
 }
 
+// prints the lists in use and the empty one above them.
 void SkipList::print() {
-	int numLists = listHeads.size();
+	int numLists = height < maxHeight ? height + 1 : height;
 	for(int i = numLists - 1; i >= 0; i--) {
 		printOneList(i);
 	}
-} 
+}
 
-SkipList::Entry* SkipList::find(Key k) {
-    int numLists = listHeads.size();
-    Quad* current = listHeads[numLists - 1];
+SkipList::Entry* SkipList::find(std::string_view k) {
+    Entry* current = head;
 
-    while (current->below != NULL) {
-        current = current->below;			// drop down
-        while(k >= current->next->entry->getKey()) {	// scan forward
-            current = current->next;
+    for(int level = height - 1; level >= 0; level--) {	// drop down
+        Entry* next = current->next()[level];
+        while(next != NULL && next->key <= k) {		// scan forward
+            current = next;
+            next = current->next()[level];
         }
-    } 
+    }
 
-    if(current->entry->key == k) {
-        return current->entry;
+    if(current != head && current->key == k) {
+        return current;
     }
     else {
         return NULL;
     }
 }
 
-// the "trail" is a vector of the last node visited on each list
-// the last element of trail is on the lowest list; the first is on the highest.
-std::vector<SkipList::Quad*>* SkipList::findWithTrail(Key k) {
-    std::vector<SkipList::Quad*>* trail = new std::vector<Quad*>();
+// the "trail" is the last entry with a key less than k on each list, indexed by
+// list: the first element is on the lowest list. Lists not in use are trailed by
+// head, so the caller's array, of kMaxHeight entries, covers every list a new
+// entry could be on. Returns the entry holding k, or NULL.
+SkipList::Entry* SkipList::findWithTrail(std::string_view k, Entry** trail) {
+    for(int level = height; level < maxHeight; level++) {
+        trail[level] = head;
+    }
+
+    Entry* current = head;
+    for(int level = height - 1; level >= 0; level--) {
+        Entry* next = current->next()[level];
+        while(next != NULL && next->key < k) {		// scan forward
+            current = next;
+            next = current->next()[level];
+        }
+        trail[level] = current;				// drop down
+    }
+
+    Entry* found = current->next()[0];
+    return found != NULL && found->key == k ? found : NULL;
+}
+
+// links a new entry in after the trail.
+void SkipList::link(Entry* entry, Entry** trail) {
+    Entry* after = trail[0]->next()[0];
+    entry->prev = trail[0];
+    (after != NULL ? after : head)->prev = entry;
+
+    for(int level = 0; level < entry->height; level++) {
+        entry->next()[level] = trail[level]->next()[level];
+        trail[level]->next()[level] = entry;
+    }
+    if(entry->height > height) {
+        height = entry->height;
+    }
+}
+
+// the last entry with a key less than k (or equal to k, if orEqual); head if there is none.
+SkipList::Entry* SkipList::lastBefore(std::string_view k, bool orEqual) {
+    Entry* current = head;
+
+    for(int level = height - 1; level >= 0; level--) {
+        Entry* next = current->next()[level];
+        while(next != NULL && (next->key < k || (orEqual && next->key == k))) {
+            current = next;
+            next = current->next()[level];
+        }
+    }
+    return current;
+}
+
+void SkipList::insert(const Key& k, const Value& v) {
+    Entry* trail[kMaxHeight];
+    Entry* found = findWithTrail(k, trail);
+
+    if(found != NULL) {
+        found->value = v;
+    }
+    else {
+        link(newEntry(Key(k), Value(v), randomHeight()), trail);
+    }
+}
+
+void SkipList::insert(Key&& k, Value&& v) {
+    Entry* trail[kMaxHeight];
+    Entry* found = findWithTrail(k, trail);
+
+    if(found != NULL) {
+        found->value = std::move(v);
+    }
+    else {
+        link(newEntry(std::move(k), std::move(v), randomHeight()), trail);
+    }
+}
 
-    int numLists = listHeads.size();
-    Quad* current = listHeads[numLists - 1];
+void SkipList::remove(std::string_view k) {
+    Entry* trail[kMaxHeight];
+    Entry* found = findWithTrail(k, trail);
 
-    while (current != NULL) {
-        while(k >= current->next->entry->getKey()) {	// scan forward
-            current = current->next;
+    if(found != NULL) {
+        Entry* after = found->next()[0];
+        (after != NULL ? after : head)->prev = found->prev;
+        for(int level = 0; level < found->height; level++) {
+            trail[level]->next()[level] = found->next()[level];
         }
-	trail->push_back(current);
-        current = current->below;			// drop down
-    } 
-    return trail;
+        freeEntry(found);
+
+        // drop the lists left empty
+        while(height > 1 && head->next()[height - 1] == NULL) {
+            height--;
+        }
+    }
 }
 
+SkipList::Entry* SkipList::ceilingEntry(std::string_view k) {
+    return lastBefore(k, false)->next()[0];
+}
+
+SkipList::Entry* SkipList::floorEntry(std::string_view k) {
+    Entry* last = lastBefore(k, true);
+    return last == head ? NULL : last;
+}
 
-// fill in the assigned functions here.
+SkipList::Entry* SkipList::greaterEntry(std::string_view k) {
+    return lastBefore(k, true)->next()[0];
+}
 
+SkipList::Entry* SkipList::lesserEntry(std::string_view k) {
+    Entry* last = lastBefore(k, false);
+    return last == head ? NULL : last;
+}
 
+SkipList::Iterator SkipList::lower_bound(std::string_view k) {
+    return Iterator(lastBefore(k, false)->next()[0], head);
+}
 
+SkipList::Iterator SkipList::upper_bound(std::string_view k) {
+    return Iterator(lastBefore(k, true)->next()[0], head);
+}
 
+SkipList::Range SkipList::range(std::string_view lo, std::string_view hi) {
+    if(hi < lo) {
+        return Range(end(), end());
+    }
+    return Range(lower_bound(lo), upper_bound(hi));
+}
@@ -1,52 +1,122 @@
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include <cstddef>
+#include <iterator>
 #include <string>
-#include <vector>
+#include <string_view>
 
 typedef std::string Key;
 typedef std::string Value;
 
 class SkipList {
     public:
+	// An entry is a single allocation: the key, the value, and then the
+	// entry's next pointers, one for each list it is on, lowest list first.
+	// The lowest list is also linked backwards, for iterators.
 	class Entry {
 	    public:
 		Key& getKey() {return key;}
 		Value& getValue() {return value;}
 
 	    private:
-		Entry(Key k, Value v) : key(k), value(v) {}
+		Entry(Key&& k, Value&& v, int height) : key(std::move(k)), value(std::move(v)), height(height) {}
 		Key key;
 		Value value;
+		Entry* prev;	// the entry before on the lowest list; head's is the last entry
+		int height;	// number of lists the entry is on
+
+		Entry** next() {return reinterpret_cast<Entry**>(this + 1);}
 	    friend class SkipList;
 	};
 
-	SkipList();
+	static const int kMaxHeight = 64;
+
+	SkipList(int maxHeight = 32);	// at most kMaxHeight
+	~SkipList();
+	SkipList(const SkipList&) = delete;
+	SkipList& operator=(const SkipList&) = delete;
 
-	Entry* find(Key k);
+	// lookups take any string-like key (std::string, a literal, a
+	// string_view) without copying it, and allocate nothing.
+	Entry* find(std::string_view k);
 	void print();
-        void insert(Key k, Value v);
-        void remove(Key k);
-	Entry* ceilingEntry(Key k);
-	Entry* floorEntry(Key k);
-	Entry* greaterEntry(Key k);
-	Entry* lesserEntry(Key k);
+	// inserts k, or replaces its value if k is already in the list. The key
+	// and value are moved into the entry when passed as rvalues; the key is
+	// only copied or moved when k is new.
+        void insert(const Key& k, const Value& v);
+        void insert(Key&& k, Value&& v);
+        void remove(std::string_view k);
+	Entry* ceilingEntry(std::string_view k);
+	Entry* floorEntry(std::string_view k);
+	Entry* greaterEntry(std::string_view k);
+	Entry* lesserEntry(std::string_view k);
+
+	// bidirectional iterator over the lowest list, in key order. An iterator
+	// stays valid until its entry is removed; each step follows one pointer.
+	class Iterator {
+	    public:
+		typedef std::bidirectional_iterator_tag iterator_category;
+		typedef Entry value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef Entry* pointer;
+		typedef Entry& reference;
+
+		Entry& operator*() const {return *entry;}
+		Entry* operator->() const {return entry;}
+		Iterator& operator++() {entry = entry->next()[0]; return *this;}
+		Iterator& operator--() {entry = entry == NULL ? head->prev : entry->prev; return *this;}
+		Iterator operator++(int) {Iterator old = *this; ++*this; return old;}
+		Iterator operator--(int) {Iterator old = *this; --*this; return old;}
+		bool operator==(const Iterator& other) const {return entry == other.entry;}
+		bool operator!=(const Iterator& other) const {return entry != other.entry;}
 
-    private:
-	class Quad {
 	    private:
-	        Quad* prev;
-	        Quad* next;
-	        Quad* above;
-	        Quad* below;
+		Entry* entry;	// NULL at end()
+		Entry* head;
 
-		Entry* entry;
+		Iterator(Entry* entry, Entry* head) : entry(entry), head(head) {}
+	    friend class SkipList;
+	};
 
-		Quad(Entry* e) : entry(e) {}
+	// the entries between two iterators, for range-based for loops.
+	class Range {
+	    public:
+		Iterator begin() const {return first;}
+		Iterator end() const {return last;}
+		bool empty() const {return first == last;}
+
+	    private:
+		Iterator first;
+		Iterator last;
+
+		Range(Iterator first, Iterator last) : first(first), last(last) {}
 	    friend class SkipList;
 	};
 
-	std::vector<Quad*> listHeads;
-	void makeNewLevelList();
+	Iterator begin() {return Iterator(head->next()[0], head);}
+	Iterator end() {return Iterator(NULL, head);}
+	Iterator lower_bound(std::string_view k);	// the first entry with a key >= k
+	Iterator upper_bound(std::string_view k);	// the first entry with a key > k
+	// the entries with keys in [lo, hi]: O(log n) to find, then one step per entry.
+	Range range(std::string_view lo, std::string_view hi);
+
+    private:
+	// minus infinity: on every list, and its key is never compared, so any
+	// bytes make a valid key. Every list ends in NULL, which is plus infinity.
+	Entry* head;
+	int maxHeight;	// most lists an entry can be on
+	int height;	// lists in use; the lists above are empty
+
+	static Entry* newEntry(Key&& k, Value&& v, int height);
+	static void freeEntry(Entry* entry);
+	int randomHeight();
 	void printOneList(int listNum);
 
-	std::vector<Quad*>* findWithTrail(Key k);
+	Entry* findWithTrail(std::string_view k, Entry** trail);
+	void link(Entry* entry, Entry** trail);
+	Entry* lastBefore(std::string_view k, bool orEqual);
 
 };
+
+#endif
@@ -0,0 +1,143 @@
+// Multi-threaded throughput benchmark: ConcurrentSkipList against a SkipList
+// behind one global mutex, for 1 to N threads and several read/insert/remove mixes.
+//   g++ -O2 -std=c++17 -pthread skipListBench.cpp ConcurrentSkipList.cpp SkipList.cpp -o skipListBench
+//   ./skipListBench [maxThreads] [opsPerThread]
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "SkipList.h"
+#include "ConcurrentSkipList.h"
+
+using namespace std;
+
+struct Mix {
+    const char* name;
+    int readPercent;
+    int insertPercent;	// the rest are removes
+};
+
+const int kKeyRange = 1 << 18;
+
+// fixed-width keys, made once so the timed loops only copy them
+vector<string> makeKeys() {
+    vector<string> keys(kKeyRange);
+    char buffer[16];
+    for(int i = 0; i < kKeyRange; i++) {
+        snprintf(buffer, sizeof(buffer), "key%07d", i);
+        keys[i] = buffer;
+    }
+    return keys;
+}
+
+// runs opsPerThread operations on every thread and returns millions of operations per second
+template <typename Map>
+double runMix(Map& map, const vector<string>& keys, const Mix& mix, int numThreads, int opsPerThread) {
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for(int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&map, &keys, &mix, opsPerThread, t]() {
+            mt19937 rng(t * 7919 + 1);
+            uniform_int_distribution<int> keyIndex(0, kKeyRange - 1);
+            uniform_int_distribution<int> percent(0, 99);
+            string value = "value";
+            for(int i = 0; i < opsPerThread; i++) {
+                const string& key = keys[keyIndex(rng)];
+                int roll = percent(rng);
+                if(roll < mix.readPercent) {
+                    map.find(key);
+                }
+                else if(roll < mix.readPercent + mix.insertPercent) {
+                    map.insert(key, value);
+                }
+                else {
+                    map.remove(key);
+                }
+            }
+        });
+    }
+    for(thread& t : threads) {
+        t.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return numThreads * (double)opsPerThread / seconds / 1e6;
+}
+
+// the pattern being replaced: the single-threaded list behind a global mutex
+class LockedSkipList {
+    public:
+	bool find(const string& key) {lock_guard<mutex> lock(listMutex); return list.find(key) != NULL;}
+	void insert(const string& key, const string& value) {lock_guard<mutex> lock(listMutex); list.insert(key, value);}
+	void remove(const string& key) {lock_guard<mutex> lock(listMutex); list.remove(key);}
+
+    private:
+	SkipList list;
+	mutex listMutex;
+};
+
+// the concurrent list's find copies the value out
+class ConcurrentMap {
+    public:
+	bool find(const string& key) {Value value; return list.find(key, value);}
+	void insert(const string& key, const string& value) {list.insert(key, value);}
+	void remove(const string& key) {list.remove(key);}
+
+    private:
+	ConcurrentSkipList list;
+};
+
+template <typename Map>
+void preload(Map& map, const vector<string>& keys) {
+    // every other key, so reads hit about half the time
+    for(int i = 0; i < kKeyRange; i += 2) {
+        map.insert(keys[i], "value");
+    }
+}
+
+int main(int argc, char** argv) {
+    int maxThreads = argc > 1 ? atoi(argv[1]) : max(1u, thread::hardware_concurrency());
+    int opsPerThread = argc > 2 ? atoi(argv[2]) : 200000;
+    vector<string> keys = makeKeys();
+
+    vector<Mix> mixes = {
+        {"read-only", 100, 0},
+        {"read-mostly", 90, 5},
+        {"balanced", 50, 25},
+        {"write-heavy", 10, 45},
+    };
+
+    // powers of two up to maxThreads, then maxThreads itself
+    vector<int> threadCounts;
+    for(int numThreads = 1; numThreads < maxThreads; numThreads *= 2) {
+        threadCounts.push_back(numThreads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    cout << kKeyRange << " keys, " << opsPerThread << " ops per thread (Mops/s)" << endl;
+    cout << setw(12) << "mix" << setw(9) << "threads" << setw(12) << "lock-free" << setw(12) << "mutex" << endl;
+
+    for(const Mix& mix : mixes) {
+        for(int numThreads : threadCounts) {
+            ConcurrentMap concurrentMap;
+            LockedSkipList lockedList;
+            preload(concurrentMap, keys);
+            preload(lockedList, keys);
+
+            double concurrent = runMix(concurrentMap, keys, mix, numThreads, opsPerThread);
+            double locked = runMix(lockedList, keys, mix, numThreads, opsPerThread);
+
+            cout << fixed << setprecision(2)
+                 << setw(12) << mix.name
+                 << setw(9) << numThreads
+                 << setw(12) << concurrent
+                 << setw(12) << locked << endl;
+        }
+    }
+}